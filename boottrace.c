@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Boot timeline tracer
+ *
+ * Besides the spans recorded explicitly by the platform, a marker is
+ * registered at the earliest priority of every initcall class. The platform
+ * library is linked first, so each marker runs before the other entries of
+ * its class and the span between two markers is the time spent in that
+ * class of the inittab.
+ */
+
+#include <uk/init.h>
+#include <uk/print.h>
+#include <uk/essentials.h>
+#include <raspi/boottrace.h>
+#include <raspi/time.h>
+
+struct raspi_boottrace_rec {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	uint32_t cpu;
+};
+
+/* Written by start.S while the MMU is off, so it cannot live in .bss */
+extern uint64_t RPi_BootStamps[BOOTTRACE_STAMP_COUNT];
+
+static struct raspi_boottrace_rec records[CONFIG_RASPI_BOOTTRACE_RECORDS];
+static unsigned int nr_records;
+
+static inline uint32_t boottrace_cpu(void)
+{
+	uint64_t mpidr;
+
+	__asm__ __volatile__("mrs %0, mpidr_el1" : "=r"(mpidr));
+	return mpidr & 0x3;
+}
+
+static int boottrace_alloc(const char *name, uint64_t start)
+{
+	unsigned int i = __atomic_fetch_add(&nr_records, 1, __ATOMIC_RELAXED);
+
+	if (unlikely(i >= CONFIG_RASPI_BOOTTRACE_RECORDS))
+		return -1;
+
+	records[i].name = name;
+	records[i].start = start;
+	records[i].end = 0;
+	records[i].cpu = boottrace_cpu();
+	return i;
+}
+
+int raspi_boottrace_begin(const char *name)
+{
+	return boottrace_alloc(name, get_system_timer());
+}
+
+void raspi_boottrace_end(int handle)
+{
+	if (handle >= 0)
+		records[handle].end = get_system_timer();
+}
+
+void raspi_boottrace_record(const char *name, uint64_t start, uint64_t end)
+{
+	int i = boottrace_alloc(name, start);
+
+	if (i >= 0)
+		records[i].end = end;
+}
+
+void raspi_boottrace_init(void)
+{
+	const uint64_t *s = RPi_BootStamps;
+
+	raspi_boottrace_record("asm: early boot, park cores",
+			       s[BOOTTRACE_STAMP_ENTRY], s[BOOTTRACE_STAMP_MEMSPLIT]);
+	raspi_boottrace_record("asm: memory split query",
+			       s[BOOTTRACE_STAMP_MEMSPLIT], s[BOOTTRACE_STAMP_PAGETABLES]);
+	raspi_boottrace_record("asm: page tables",
+			       s[BOOTTRACE_STAMP_PAGETABLES], s[BOOTTRACE_STAMP_MMU]);
+	raspi_boottrace_record("asm: MMU enable",
+			       s[BOOTTRACE_STAMP_MMU], s[BOOTTRACE_STAMP_BSS]);
+	raspi_boottrace_record("asm: bss clear",
+			       s[BOOTTRACE_STAMP_BSS], s[BOOTTRACE_STAMP_C_ENTRY]);
+}
+
+void raspi_boottrace_dump(void)
+{
+	unsigned int n = MIN(nr_records, (unsigned int) CONFIG_RASPI_BOOTTRACE_RECORDS);
+	uint64_t t0 = RPi_BootStamps[BOOTTRACE_STAMP_ENTRY];
+
+#if CONFIG_RASPI_BOOTTRACE_CHROME
+	uk_pr_info("{\"traceEvents\":[\n");
+	for (unsigned int i = 0; i < n; i++) {
+		const struct raspi_boottrace_rec *r = &records[i];
+		uint64_t end = r->end ? r->end : r->start;
+
+		uk_pr_info("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+			   "\"pid\":0,\"tid\":%u}%s\n",
+			   r->name, (unsigned long) (r->start - t0),
+			   (unsigned long) (end - r->start), r->cpu,
+			   (i + 1 < n) ? "," : "");
+	}
+	uk_pr_info("],\"displayTimeUnit\":\"ms\"}\n");
+#else
+	uk_pr_info("Boot timeline (us since _start):\n");
+	uk_pr_info("%10s %10s  cpu  %s\n", "start", "duration", "stage");
+	for (unsigned int i = 0; i < n; i++) {
+		const struct raspi_boottrace_rec *r = &records[i];
+
+		if (r->end)
+			uk_pr_info("%10lu %10lu  %3u  %s\n",
+				   (unsigned long) (r->start - t0),
+				   (unsigned long) (r->end - r->start),
+				   r->cpu, r->name);
+		else
+			uk_pr_info("%10lu %10s  %3u  %s\n",
+				   (unsigned long) (r->start - t0), "open",
+				   r->cpu, r->name);
+	}
+#endif
+	if (nr_records > n)
+		uk_pr_info("boottrace: %u records dropped, raise RASPI_BOOTTRACE_RECORDS\n",
+			   nr_records - n);
+}
+
+/*
+ * Initcall class markers
+ */
+static int level_handle = -1;
+
+static void boottrace_level(const char *name)
+{
+	raspi_boottrace_end(level_handle);
+	level_handle = raspi_boottrace_begin(name);
+}
+
+#define BOOTTRACE_LEVEL(class)						\
+	static int boottrace_##class(struct uk_init_ctx *ictx __unused)	\
+	{								\
+		boottrace_level("initcalls: " #class);			\
+		return 0;						\
+	}								\
+	uk_##class##_initcall_prio(boottrace_##class, 0x0, UK_PRIO_EARLIEST)
+
+BOOTTRACE_LEVEL(early);
+BOOTTRACE_LEVEL(plat);
+BOOTTRACE_LEVEL(lib);
+BOOTTRACE_LEVEL(rootfs);
+BOOTTRACE_LEVEL(sys);
+
+static int boottrace_late(struct uk_init_ctx *ictx __unused)
+{
+	boottrace_level("initcalls: late");
+	return 0;
+}
+uk_late_initcall_prio(boottrace_late, 0x0, UK_PRIO_EARLIEST);
+
+static int boottrace_done(struct uk_init_ctx *ictx __unused)
+{
+	raspi_boottrace_end(level_handle);
+	level_handle = -1;
+	raspi_boottrace_dump();
+	return 0;
+}
+uk_late_initcall_prio(boottrace_done, 0x0, UK_PRIO_LATEST);
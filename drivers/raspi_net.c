@@ -7,12 +7,32 @@
 #include <uk/netdev_core.h>
 #include <uk/netdev_driver.h>
 #include <uk/ring.h>
+#include <uk/plat/lcpu.h>
 #include <uk/sched.h>
 #include <uk/thread.h>
+#include <uk/arch/time.h>
 #include <string.h>
+#include <uspi/dmapool.h>
+#include <raspi/string.h>
+#include <raspi/boottrace.h>
+#include <raspi/time.h>
+#include <raspi_net.h>
+#include <uspi.h>
+#if defined(CONFIG_RASPI_NET_ASYNC_START) || defined(CONFIG_RASPI_NET_TX_BATCH)
+#include <uk/semaphore.h>
+#endif
 
 #define DRIVER_NAME	"raspi-net"
-#define RASPI_NET_MAX_MTU 1500
+#define RASPI_NET_DEFAULT_MTU 1500
+#define RASPI_NET_MIN_MTU 68 // RFC 791
+#ifdef CONFIG_RASPI_NET_JUMBO
+#define RASPI_NET_MAX_MTU 9000 // LAN7800 only, the SMSC951x stays at RASPI_NET_DEFAULT_MTU
+#else
+#define RASPI_NET_MAX_MTU RASPI_NET_DEFAULT_MTU
+#endif
+#define RASPI_RX_BUFFER_SIZE USPI_FRAME_BUFFER_SIZE
+#define RASPI_NET_MAX_MCAST 64 // More multicast addresses let all multicast frames pass
+#define RASPI_RX_DMA_ALIGN 64 // Cache line size, netbufs received into directly must not share lines
 #define RASPI_PKT_BUFFER_ALIGN 2048 // Might not need this or it can be different but it was currently just taken from `VIRTIO_PKT_BUFFER_ALIGN` to avoid petintial virtual memory issues?
 #define RASPI_MAX_QUEUE_PAIRS 1
 #define RASPI_MAX_N_DESCRIPTORS 2048 // TODO: This was kind of chosen randomly. In Linux, you can find this value by inspecting the virtio device's configuration. This can be done by reading the /sys filesystem, specifically the /sys/class/net/<device>/queues/tx-<queue>/tx_max_batch file, where <device> is the name of your network device and <queue> is the number of the queue you're interested in. Or maybe try ethtool.
@@ -22,7 +42,7 @@ typedef enum {
 	RNET_TX,
 } raspiq_type_t;
 
-// TODO: These queues and rings are currently not really used but would be usefull if a non polling version of this device would ever be implemented.
+// With RASPI_NET_RX_INTR the rx ring carries the netbufs filled by the USB completion routine, with RASPI_NET_TX_ASYNC the tx ring the netbufs waiting for a free transfer slot.
 /**
  * @internal structure to represent the transmit queue.
  */
@@ -35,6 +55,21 @@ struct raspi_netdev_tx_queue {
 	__u8 intr_enabled;
 	/* Reference to the uk_netdev */
 	struct uk_netdev *ndev;
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	/* Netbufs whose transfer finished, freed on the next tx_one */
+	struct uk_ring *done;
+	/* Netbufs posted for transmit, taken from the ring */
+	struct raspi_netdev_tx_slot {
+		struct raspi_netdev_tx_queue *txq;
+		struct uk_netbuf *netbuf;
+	} slots[CONFIG_RASPI_NET_TX_ASYNC_URBS];
+	/* Failed transfers, reported by the next tx_one */
+	unsigned errors;
+#endif
+#ifdef CONFIG_RASPI_NET_TSO
+	/* Segment of a TSO frame split in software */
+	__u8 tso_seg[USPI_FRAME_BUFFER_SIZE];
+#endif
 	/* The scatter list and its associated fragements */
 	// struct uk_sglist sg;
 	// struct uk_sglist_seg sgsegs[NET_MAX_FRAGMENTS];
@@ -56,6 +91,19 @@ struct raspi_netdev_rx_queue {
 	__u8 intr_enabled;
 	/* Reference to the uk_netdev */
 	struct uk_netdev *ndev;
+	/* Non-cacheable bounce buffer for netbufs too small to receive into */
+	unsigned char *rx_buf;
+	/* Netbuf allocated for a receive that found no frame, used next time */
+	struct uk_netbuf *spare;
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	/* Netbufs posted for receive, completed ones go to the ring */
+	struct raspi_netdev_rx_slot {
+		struct raspi_netdev_rx_queue *rxq;
+		struct uk_netbuf *netbuf;
+	} slots[CONFIG_RASPI_NET_RX_INTR_URBS];
+	/* Set while a thread posts netbufs to the slots */
+	int filling;
+#endif
 	/* The scatter list and its associated fragements */
 	// struct uk_sglist sg;
 	// struct uk_sglist_seg sgsegs[NET_MAX_FRAGMENTS];
@@ -77,14 +125,36 @@ struct raspi_net_device {
 	__u16 uid;
 	// /* The max mtu */
 	// __u16 max_mtu;
-	// /* The mtu */
-	// __u16 mtu;
+	/* The mtu, programmed into the device once it is enumerated */
+	__u16 mtu;
+	/* Receive buffer size for the programmed mtu, netbufs at least this
+	 * large are received into directly
+	 */
+	unsigned rx_size;
 	/* The hw address of the netdevice */
 	struct uk_hwaddr hw_addr;
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	/* Set by the bring-up thread, RASPI_LINK_* */
+	int link_state;
+	/* Posted once the bring-up thread finishes */
+	struct uk_semaphore link_sem;
+	raspi_net_link_cb_t link_cb;
+	void *link_cb_argp;
+	int link_notified;
+	/* Serializes the setters against each other and against the bring-up
+	 * thread, which programs the settings and publishes the link
+	 */
+	struct uk_semaphore settings_sem;
+#endif
 	// /*  Netdev state */
 	// __u8 state;
-	// /* RX promiscuous mode. */
-	// __u8 promisc : 1;
+	/* RX promiscuous mode. */
+	int promisc;
+	/* All multicast frames pass, the list did not fit */
+	int allmulti;
+	/* Multicast addresses passed by the device's receive filter */
+	__u8 mcast[RASPI_NET_MAX_MCAST][UK_NETDEV_HWADDR_LEN];
+	unsigned mcast_count;
 };
 
 #define to_raspinetdev(ndev) \
@@ -96,6 +166,304 @@ struct raspi_net_device {
 static const char *drv_name = DRIVER_NAME;
 static struct uk_alloc *a;
 
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+/* Held while frames are queued into or flushed from the batch in USPi */
+static struct uk_semaphore tx_batch_lock;
+/* Posted when a batch is started, wakes up the flusher thread */
+static struct uk_semaphore tx_batch_started;
+/* System timer (us) when the first frame of the pending batch was queued */
+static uint64_t tx_batch_start;
+
+/* Called with tx_batch_lock held */
+static void raspi_net_tx_flush_locked(void)
+{
+	if (!tx_batch_start)
+		return;
+
+	tx_batch_start = 0;
+	if (!USPiFlushFrames())
+		uk_pr_err("Failed to send frame batch\n");
+}
+
+void raspi_net_tx_flush(void)
+{
+	uk_semaphore_down(&tx_batch_lock);
+	raspi_net_tx_flush_locked();
+	uk_semaphore_up(&tx_batch_lock);
+}
+
+/* Sends the pending batch if it is due, else returns the us left until then */
+static uint64_t raspi_net_tx_flush_expired(void)
+{
+	uint64_t age, left = 0;
+
+	uk_semaphore_down(&tx_batch_lock);
+	if (tx_batch_start) {
+		age = get_system_timer() - tx_batch_start;
+		if (age >= CONFIG_RASPI_NET_TX_BATCH_TIMEOUT_US)
+			raspi_net_tx_flush_locked();
+		else
+			left = CONFIG_RASPI_NET_TX_BATCH_TIMEOUT_US - age;
+	}
+	uk_semaphore_up(&tx_batch_lock);
+
+	return left;
+}
+
+/* Sends every batch at the latest RASPI_NET_TX_BATCH_TIMEOUT_US after its
+ * first frame, also when no further frame or poll comes along
+ */
+static void raspi_net_tx_flusher(void *arg __unused)
+{
+	uint64_t left;
+
+	for (;;) {
+		uk_semaphore_down(&tx_batch_started);
+		while ((left = raspi_net_tx_flush_expired()) != 0)
+			uk_sched_thread_sleep(ukarch_time_usec_to_nsec(left));
+	}
+}
+#endif
+
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+#define RASPI_LINK_PENDING	0
+#define RASPI_LINK_UP		1
+#define RASPI_LINK_FAILED	2
+
+/* Only a single device is supported */
+static struct raspi_net_device *raspi_ndev;
+
+static inline int raspi_net_ready(struct raspi_net_device *d)
+{
+	return __atomic_load_n(&d->link_state, __ATOMIC_ACQUIRE) == RASPI_LINK_UP;
+}
+#endif
+
+/* Returns != 0 once the USB device has been enumerated */
+static inline int raspi_net_hw_up(struct raspi_net_device *d)
+{
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	return raspi_net_ready(d);
+#else
+	return d->netdev._data->state == UK_NETDEV_RUNNING;
+#endif
+}
+
+/**
+ * Held while a setting is stored in d and programmed into the device. A
+ * setter that finds the device not yet up leaves it to the bring-up.
+ */
+static inline void raspi_net_settings_lock(struct raspi_net_device *d)
+{
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	uk_semaphore_down(&d->settings_sem);
+#else
+	(void) d;
+#endif
+}
+
+static inline void raspi_net_settings_unlock(struct raspi_net_device *d)
+{
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	uk_semaphore_up(&d->settings_sem);
+#else
+	(void) d;
+#endif
+}
+
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+/* Adds len bytes at p to the ones' complement sum */
+static __u32 raspi_net_csum_add(__u32 sum, const __u8 *p, size_t len)
+{
+	for (; len > 1; p += 2, len -= 2)
+		sum += (__u32)p[0] << 8 | p[1];
+	if (len)
+		sum += (__u32)p[0] << 8;
+
+	return sum;
+}
+
+/* Stores the folded and complemented sum at field, in network order */
+static void raspi_net_csum_store(__u8 *field, __u32 sum)
+{
+	__u16 csum;
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	csum = ~sum;
+	field[0] = csum >> 8;
+	field[1] = csum & 0xff;
+}
+
+/* Inserts the checksum the stack left to the device */
+static void raspi_net_csum_complete(struct uk_netbuf *pkt)
+{
+	__u8 *data = pkt->data;
+
+	UK_ASSERT(pkt->csum_start + pkt->csum_offset + 2 <= pkt->len);
+
+	/* The field holds the pseudo header sum, it is summed up too */
+	raspi_net_csum_store(data + pkt->csum_start + pkt->csum_offset,
+			     raspi_net_csum_add(0, data + pkt->csum_start,
+						pkt->len - pkt->csum_start));
+	pkt->flags &= ~UK_NETBUF_F_PARTIAL_CSUM;
+}
+#endif
+
+static inline int raspi_net_tx_is_tso(struct uk_netbuf *pkt __maybe_unused)
+{
+#ifdef CONFIG_RASPI_NET_TSO
+	return pkt->gso_type == UK_NETBUF_GSO_TYPE_TCPV4;
+#else
+	return 0;
+#endif
+}
+
+/* Returns the USPI_FRAME_TX_* flags for the work pkt leaves to the device */
+static inline unsigned raspi_net_tx_flags(struct uk_netbuf *pkt)
+{
+	if (raspi_net_tx_is_tso(pkt))
+		return USPI_FRAME_TX_TSO | USPI_FRAME_TX_MSS(pkt->gso_size);
+	if (pkt->flags & UK_NETBUF_F_PARTIAL_CSUM)
+		return USPI_FRAME_TX_CSUM;
+
+	return 0;
+}
+
+/**
+ * Returns the USPI_FRAME_TX_* flags for pkt. A partial checksum is completed
+ * here if the device cannot insert it or the frame is sent through a copy.
+ */
+static inline unsigned raspi_net_tx_csum(struct uk_netbuf *pkt,
+					 int in_place __maybe_unused)
+{
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+	if ((pkt->flags & UK_NETBUF_F_PARTIAL_CSUM)
+	    && !(in_place && USPiEthernetChecksumOffload()))
+		raspi_net_csum_complete(pkt);
+#endif
+	return raspi_net_tx_flags(pkt);
+}
+
+/* lwIP reserves nb_encap_tx bytes of headroom, the device's TX command
+ * words go there and the controller reads the netbuf directly.
+ */
+static inline int raspi_net_tx_in_place(struct uk_netbuf *pkt)
+{
+	return uk_netbuf_headroom(pkt) >= USPI_FRAME_TX_HEADROOM
+	       && !(((uintptr_t)pkt->data - USPI_FRAME_TX_HEADROOM) & 3);
+}
+
+#ifdef CONFIG_RASPI_NET_TSO
+#define RASPI_ETH_HLEN		14
+#define RASPI_ETH_P_IP		0x0800
+#define RASPI_IP_HLEN_MIN	20
+#define RASPI_TCP_HLEN_MIN	20
+#define RASPI_TCP_FLAG_FIN	0x01
+#define RASPI_TCP_FLAG_PSH	0x08
+#define RASPI_TCP_FLAG_CWR	0x80
+
+static inline void raspi_net_put16(__u8 *p, __u16 v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+/**
+ * Splits a TSO frame into gso_size TCP segments and sends each through a
+ * copy, for netbufs the hardware cannot segment. Only untagged TCP/IPv4
+ * frames are handled.
+ */
+static int raspi_net_tso_segment(struct raspi_netdev_tx_queue *txq,
+				 struct uk_netbuf *pkt)
+{
+	__u8 *seg = txq->tso_seg;
+	const __u8 *data = pkt->data;
+	const __u8 *ip = data + RASPI_ETH_HLEN;
+	unsigned iphl, tcphl, hdrlen;
+	unsigned mss = pkt->gso_size;
+	unsigned off, len;
+	__u32 seq;
+	__u16 id;
+	__u8 *segip, *segtcp;
+	__u32 sum;
+
+	/* A VLAN tag would move the IP header */
+	if (unlikely(pkt->len < RASPI_ETH_HLEN + RASPI_IP_HLEN_MIN
+		     || (data[12] << 8 | data[13]) != RASPI_ETH_P_IP)) {
+		uk_pr_err("Cannot segment TSO frame (no TCP/IPv4 header)\n");
+		return 0;
+	}
+
+	iphl = (ip[0] & 0x0f) * 4;
+	if (unlikely(iphl < RASPI_IP_HLEN_MIN
+		     || pkt->len < RASPI_ETH_HLEN + iphl + RASPI_TCP_HLEN_MIN)) {
+		uk_pr_err("Cannot segment TSO frame (IP header %u)\n", iphl);
+		return 0;
+	}
+
+	tcphl = (ip[iphl + 12] >> 4) * 4;
+	hdrlen = RASPI_ETH_HLEN + iphl + tcphl;
+	if (unlikely(!mss || tcphl < RASPI_TCP_HLEN_MIN || hdrlen >= pkt->len
+		     || hdrlen + mss > sizeof(txq->tso_seg))) {
+		uk_pr_err("Cannot segment TSO frame (mss %u, header %u)\n",
+			  mss, hdrlen);
+		return 0;
+	}
+
+	seq = (__u32)ip[iphl + 4] << 24 | (__u32)ip[iphl + 5] << 16
+	      | (__u32)ip[iphl + 6] << 8 | ip[iphl + 7];
+	id = (__u16)ip[4] << 8 | ip[5];
+
+	for (off = hdrlen; off < pkt->len; off += len) {
+		len = MIN(mss, pkt->len - off);
+
+		raspi_memcpy(seg, data, hdrlen);
+		raspi_memcpy(seg + hdrlen, data + off, len);
+		segip = seg + RASPI_ETH_HLEN;
+		segtcp = segip + iphl;
+
+		raspi_net_put16(segip + 2, iphl + tcphl + len);
+		raspi_net_put16(segip + 4, id++);
+		raspi_net_put16(segip + 10, 0);
+		raspi_net_csum_store(segip + 10, raspi_net_csum_add(0, segip, iphl));
+
+		sum = seq + (off - hdrlen);
+		segtcp[4] = sum >> 24;
+		segtcp[5] = sum >> 16;
+		segtcp[6] = sum >> 8;
+		segtcp[7] = sum;
+		if (off != hdrlen)
+			segtcp[13] &= ~RASPI_TCP_FLAG_CWR;
+		if (off + len < pkt->len)
+			segtcp[13] &= ~(RASPI_TCP_FLAG_FIN | RASPI_TCP_FLAG_PSH);
+
+		/* Pseudo header: addresses, protocol and TCP length */
+		raspi_net_put16(segtcp + 16, 0);
+		sum = raspi_net_csum_add(0, segip + 12, 8);
+		sum += segip[9] + tcphl + len;
+		raspi_net_csum_store(segtcp + 16,
+				     raspi_net_csum_add(sum, segtcp, tcphl + len));
+
+		if (!USPiSendFrame(seg, hdrlen + len))
+			return 0;
+	}
+
+	return 1;
+}
+#endif /* CONFIG_RASPI_NET_TSO */
+
+/* Marks netbuf valid if the device has verified the checksums of frame */
+static inline void raspi_net_rx_csum(struct uk_netbuf *netbuf __maybe_unused,
+				     const void *frame __maybe_unused)
+{
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+	if (USPiFrameChecksumValid(frame))
+		netbuf->flags |= UK_NETBUF_F_DATA_VALID;
+#endif
+}
+
 static int rasp_net_drv_init(struct uk_alloc *drv_allocator)
 {
 	/* driver initialization */
@@ -103,44 +471,433 @@ static int rasp_net_drv_init(struct uk_alloc *drv_allocator)
 		return -EINVAL;
 
 	a = drv_allocator;
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	uk_semaphore_init(&tx_batch_lock, 1);
+	uk_semaphore_init(&tx_batch_started, 0);
+#endif
 	return 0;
 }
 
+#ifdef CONFIG_RASPI_NET_RX_INTR
+/* Runs in interrupt context when a posted receive completes */
+static void raspi_netdev_rx_done(void *buf, unsigned len, unsigned offset,
+				 void *argp)
+{
+	struct raspi_netdev_rx_slot *slot = argp;
+	struct raspi_netdev_rx_queue *rxq = slot->rxq;
+	struct uk_netbuf *netbuf = slot->netbuf;
+
+	UK_ASSERT(netbuf && netbuf->buf == buf);
+	UK_ASSERT(offset + len <= RASPI_RX_BUFFER_SIZE);
+
+	/* A zero length tells raspi_netdev_recv to free the netbuf */
+	netbuf->data = (char *)netbuf->buf + offset;
+	netbuf->len = len;
+	if (len)
+		raspi_net_rx_csum(netbuf, netbuf->data);
+
+	/* The ring has more entries than there are slots */
+	if (unlikely(uk_ring_enqueue(rxq->rq, netbuf) != 0))
+		UK_CRASH("raspi-net rx ring overflow\n");
+	__atomic_store_n(&slot->netbuf, NULL, __ATOMIC_RELEASE);
+
+	if (rxq->intr_enabled)
+		uk_netdev_drv_rx_event(rxq->ndev, 0);
+}
+
+/**
+ * Posts a netbuf to each free slot, called from thread context. A slot that
+ * stays empty is retried on the next receive or transmit.
+ */
+static void raspi_netdev_rx_fillup(struct raspi_netdev_rx_queue *rxq)
+{
+	struct raspi_netdev_rx_slot *slot;
+	struct uk_netbuf *netbuf;
+	unsigned rx_size;
+	unsigned i;
+
+	/* rx_one and tx_one may run on different threads */
+	if (__atomic_exchange_n(&rxq->filling, 1, __ATOMIC_ACQUIRE))
+		return;
+
+	for (i = 0; i < CONFIG_RASPI_NET_RX_INTR_URBS; i++) {
+		slot = &rxq->slots[i];
+		if (__atomic_load_n(&slot->netbuf, __ATOMIC_ACQUIRE))
+			continue;
+
+		if (rxq->alloc_rxpkts(rxq->alloc_rxpkts_argp, &netbuf, 1) != 1) {
+			uk_pr_err("Failed allocate memory for received ethernet frame\n");
+			break;
+		}
+
+		/* The controller writes into the netbuf, it must own its lines */
+		rx_size = __atomic_load_n(&to_raspinetdev(rxq->ndev)->rx_size,
+					  __ATOMIC_RELAXED);
+		if (unlikely(netbuf->buflen < rx_size
+			     || ((uintptr_t)netbuf->buf & (RASPI_RX_DMA_ALIGN - 1)))) {
+			uk_pr_err("Netbuf unsuitable for receive (%p, %zu bytes)\n",
+				  netbuf->buf, (size_t)netbuf->buflen);
+			uk_netbuf_free(netbuf);
+			break;
+		}
+
+		slot->netbuf = netbuf;
+		if (!USPiReceiveFrameAsync(netbuf->buf, rx_size,
+					   raspi_netdev_rx_done, slot)) {
+			uk_pr_err("Failed to post receive\n");
+			slot->netbuf = NULL;
+			uk_netbuf_free(netbuf);
+			break;
+		}
+	}
+
+	__atomic_store_n(&rxq->filling, 0, __ATOMIC_RELEASE);
+}
+
+/* Returns != 0 if a slot has no receive posted */
+static int raspi_netdev_rx_starved(struct raspi_netdev_rx_queue *rxq)
+{
+	unsigned i;
+
+	for (i = 0; i < CONFIG_RASPI_NET_RX_INTR_URBS; i++)
+		if (!__atomic_load_n(&rxq->slots[i].netbuf, __ATOMIC_ACQUIRE))
+			return 1;
+
+	return 0;
+}
+
+static int raspi_netdev_rxq_intr_enable(struct uk_netdev *dev __unused,
+					 struct raspi_netdev_rx_queue *rxq)
+{
+	__atomic_store_n(&rxq->intr_enabled, 1, __ATOMIC_SEQ_CST);
+
+	/* Frames that completed meanwhile raised no event, and an empty slot
+	 * raises none until rx_one posts to it again
+	 */
+	return uk_ring_empty(rxq->rq) && !raspi_netdev_rx_starved(rxq) ? 0 : 1;
+}
+
+static int raspi_netdev_rxq_intr_disable(struct uk_netdev *dev __unused,
+					  struct raspi_netdev_rx_queue *rxq)
+{
+	__atomic_store_n(&rxq->intr_enabled, 0, __ATOMIC_SEQ_CST);
+
+	return 0;
+}
+#endif /* CONFIG_RASPI_NET_RX_INTR */
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+static void raspi_netdev_tx_retry(struct raspi_netdev_tx_queue *txq);
+#endif
+
 static int raspi_netdev_recv(struct uk_netdev *dev,
 			      struct raspi_netdev_rx_queue *rxq,
 			      struct uk_netbuf **pkt)
 {
-	unsigned char Buffer[1600] = {0x0};
-	unsigned nFrameLength;
-	if (!USPiReceiveFrame (Buffer, &nFrameLength))
-	{
+	struct uk_netbuf *netbuf;
+	unsigned nFrameLength, nFrameOffset;
+#ifndef CONFIG_RASPI_NET_RX_AGGREGATE
+	unsigned rx_size;
+#endif
+
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	if (unlikely(!raspi_net_ready(to_raspinetdev(dev))))
 		return 0;
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	raspi_netdev_tx_retry(&to_raspinetdev(dev)->txqs[0]);
+#endif
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	/* The channel paths only count, the report is printed from here */
+	USPiCycleTraceDump();
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	while ((netbuf = uk_ring_dequeue(rxq->rq)) != NULL) {
+		if (likely(netbuf->len))
+			break;
+		/* The transfer failed, the netbuf was handed back unused */
+		uk_netbuf_free(netbuf);
 	}
 
-	UK_ASSERT(nFrameLength <= 1600);
+	/* Repost the slots completed since the last call */
+	raspi_netdev_rx_fillup(rxq);
+
+	if (!netbuf)
+		return 0;
+
+	*pkt = netbuf;
+
+	return UK_NETDEV_STATUS_SUCCESS
+	       | (uk_ring_empty(rxq->rq) ? 0 : UK_NETDEV_STATUS_MORE);
+#endif
 
-	int cnt = rxq->alloc_rxpkts(rxq->alloc_rxpkts_argp, pkt, 1);
-	if (cnt != 1) {
-		uk_pr_err("Failed allocate memory for received ethernet frame\n");
-		return UK_NETDEV_STATUS_UNDERRUN;
+	netbuf = rxq->spare;
+	if (!netbuf) {
+		if (rxq->alloc_rxpkts(rxq->alloc_rxpkts_argp, &netbuf, 1) != 1) {
+			uk_pr_err("Failed allocate memory for received ethernet frame\n");
+			return UK_NETDEV_STATUS_UNDERRUN;
+		}
+		rxq->spare = netbuf;
 	}
 
-	struct uk_netbuf *netbuf = *pkt;
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	const void *pFrame;
 
-	UK_ASSERT(netbuf->buflen >= nFrameLength);
+	/* Frames arrive in batches, one bulk-IN transfer carries many */
+	if (!USPiReceiveFrameAggregated(&pFrame, &nFrameLength))
+		return 0;
+	if (unlikely(nFrameLength > netbuf->buflen)) {
+		uk_pr_err("Dropping %u byte frame, netbuf too small\n", nFrameLength);
+		return 0;
+	}
+	raspi_net_rx_csum(netbuf, pFrame);
+	raspi_memcpy(netbuf->buf, pFrame, nFrameLength);
+	nFrameOffset = 0;
+#else
+	/* The same size bounds the check and the transfer, mtu_set may race */
+	rx_size = __atomic_load_n(&to_raspinetdev(dev)->rx_size, __ATOMIC_RELAXED);
+	if (likely(netbuf->buflen >= rx_size
+		   && !((uintptr_t)netbuf->buf & (RASPI_RX_DMA_ALIGN - 1)))) {
+		/* The controller writes the RX header and frame straight into
+		 * the netbuf, the header is skipped by moving data past it.
+		 */
+		if (!USPiReceiveFrameInPlace(netbuf->buf, rx_size,
+					     &nFrameLength, &nFrameOffset))
+			return 0;
+		raspi_net_rx_csum(netbuf, (char *)netbuf->buf + nFrameOffset);
+	} else {
+		if (!USPiReceiveFrameInPlace(rxq->rx_buf, rx_size,
+					     &nFrameLength, &nFrameOffset))
+			return 0;
+		if (unlikely(nFrameLength > netbuf->buflen)) {
+			uk_pr_err("Dropping %u byte frame, netbuf too small\n", nFrameLength);
+			return 0;
+		}
+		raspi_net_rx_csum(netbuf, rxq->rx_buf + nFrameOffset);
+		raspi_memcpy(netbuf->buf, rxq->rx_buf + nFrameOffset, nFrameLength);
+		nFrameOffset = 0;
+	}
+#endif /* CONFIG_RASPI_NET_RX_AGGREGATE */
+
+	UK_ASSERT(nFrameOffset + nFrameLength <= RASPI_RX_BUFFER_SIZE);
 
-	netbuf->data = netbuf->buf;
+	rxq->spare = NULL;
+	netbuf->data = (char *)netbuf->buf + nFrameOffset;
 	netbuf->len = nFrameLength;
-	memcpy(netbuf->data, &Buffer, nFrameLength);
+	*pkt = netbuf;
 
 	return UK_NETDEV_STATUS_SUCCESS | UK_NETDEV_STATUS_MORE;
 }
 
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+static void raspi_netdev_tx_kick(struct raspi_netdev_tx_queue *txq);
+
+/* Runs in interrupt context when a posted transmit completes */
+static void raspi_netdev_tx_done(int ok, void *argp)
+{
+	struct raspi_netdev_tx_slot *slot = argp;
+	struct raspi_netdev_tx_queue *txq = slot->txq;
+
+	if (unlikely(!ok))
+		__atomic_add_fetch(&txq->errors, 1, __ATOMIC_RELAXED);
+
+	/* The done ring has room for every netbuf the queue can hold */
+	if (unlikely(uk_ring_enqueue(txq->done, slot->netbuf) != 0))
+		UK_CRASH("raspi-net tx done ring overflow\n");
+	slot->netbuf = NULL;
+
+	raspi_netdev_tx_kick(txq);
+}
+
+/* Posts queued netbufs to the free slots, called with interrupts disabled.
+ * A netbuf leaves the ring only once its transfer is posted, one that could
+ * not be is retried on the next kick.
+ */
+static void raspi_netdev_tx_kick(struct raspi_netdev_tx_queue *txq)
+{
+	struct raspi_netdev_tx_slot *slot;
+	struct uk_netbuf *netbuf;
+	unsigned flags;
+	unsigned i;
+
+	for (i = 0; i < CONFIG_RASPI_NET_TX_ASYNC_URBS; i++) {
+		slot = &txq->slots[i];
+		if (slot->netbuf)
+			continue;
+
+		netbuf = uk_ring_peek(txq->rq);
+		if (!netbuf)
+			return;
+
+		/* raspi_netdev_xmit left only what the device does */
+		flags = raspi_net_tx_flags(netbuf);
+
+		slot->netbuf = netbuf;
+		if (unlikely(!USPiSendFrameAsync(netbuf->data, netbuf->len, flags,
+						 raspi_netdev_tx_done, slot))) {
+			/* No channel free, raspi_netdev_xmit has checked the rest */
+			slot->netbuf = NULL;
+			return;
+		}
+		uk_ring_advance_sc(txq->rq);
+	}
+}
+
+/* Retries posting from thread context, nothing else kicks an idle queue */
+static void raspi_netdev_tx_retry(struct raspi_netdev_tx_queue *txq)
+{
+	unsigned long irqf;
+
+	if (!txq->rq || uk_ring_empty(txq->rq))
+		return;
+
+	irqf = ukplat_lcpu_save_irqf();
+	raspi_netdev_tx_kick(txq);
+	ukplat_lcpu_restore_irqf(irqf);
+}
+
+/* Waits until every queued netbuf has been sent, so that a synchronous
+ * send does not overtake them
+ */
+static void raspi_netdev_tx_drain(struct raspi_netdev_tx_queue *txq)
+{
+	unsigned long irqf;
+	int busy;
+	unsigned i;
+
+	do {
+		irqf = ukplat_lcpu_save_irqf();
+		raspi_netdev_tx_kick(txq);
+		busy = !uk_ring_empty(txq->rq);
+		for (i = 0; i < CONFIG_RASPI_NET_TX_ASYNC_URBS; i++)
+			busy |= txq->slots[i].netbuf != NULL;
+		ukplat_lcpu_restore_irqf(irqf);
+	} while (busy);
+}
+#endif /* CONFIG_RASPI_NET_TX_ASYNC */
+
 static int raspi_netdev_xmit(struct uk_netdev *n,
 			      struct raspi_netdev_tx_queue *queue,
 			      struct uk_netbuf *pkt)
 {
-	if (!USPiSendFrame ((const void *)pkt->data, pkt->len)) {
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	if (unlikely(!raspi_net_ready(to_raspinetdev(n))))
+		return -ENETDOWN;
+#endif
+
+	int ok;
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	/* Frames sent past the batch must not overtake the queued ones */
+	uk_semaphore_down(&tx_batch_lock);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	struct uk_netbuf *done;
+	unsigned long irqf;
+	unsigned errors, flags;
+
+	/* Netbufs of finished transfers are freed here, not in the IRQ */
+	while ((done = uk_ring_dequeue(queue->done)) != NULL)
+		uk_netbuf_free(done);
+
+	errors = __atomic_exchange_n(&queue->errors, 0, __ATOMIC_RELAXED);
+	if (unlikely(errors))
+		uk_pr_err("Failed to send %u frames\n", errors);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	/* Receives that could not be posted are retried without a frame
+	 * having to arrive first
+	 */
+	struct raspi_netdev_rx_queue *rxq = &to_raspinetdev(n)->rxqs[0];
+
+	if (unlikely(rxq->alloc_rxpkts && raspi_netdev_rx_starved(rxq)))
+		raspi_netdev_rx_fillup(rxq);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TSO
+	/* Segmented in software if the device or the netbuf cannot do it */
+	if (unlikely(raspi_net_tx_is_tso(pkt)
+		     && !(USPiEthernetSegmentationOffload()
+			  && raspi_net_tx_in_place(pkt)
+			  && pkt->len <= USPI_FRAME_TX_TSO_MAX_SIZE))) {
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+		raspi_netdev_tx_drain(queue);
+#elif defined(CONFIG_RASPI_NET_TX_BATCH)
+		raspi_net_tx_flush_locked();
+#endif
+		ok = raspi_net_tso_segment(queue, pkt);
+		goto out;
+	}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	if (likely(raspi_net_tx_in_place(pkt))) {
+		if (uk_ring_full(queue->rq))
+			return UK_NETDEV_STATUS_UNDERRUN;
+
+		/* A queued frame is retried until it is posted, so it
+		 * must be one the device takes
+		 */
+		flags = raspi_net_tx_csum(pkt, 1);
+		if (unlikely(pkt->len > (unsigned)USPiEthernetTxMaxLength(flags))) {
+			uk_pr_err("Frame of %u bytes too long to send\n",
+				  (unsigned)pkt->len);
+			return -1;
+		}
+
+		if (uk_ring_enqueue(queue->rq, pkt) != 0)
+			return UK_NETDEV_STATUS_UNDERRUN;
+
+		irqf = ukplat_lcpu_save_irqf();
+		raspi_netdev_tx_kick(queue);
+		ukplat_lcpu_restore_irqf(irqf);
+
+		return UK_NETDEV_STATUS_SUCCESS
+		       | (uk_ring_full(queue->rq) ? 0 : UK_NETDEV_STATUS_MORE);
+	}
+
+	/* No room for the TX header, send a copy synchronously once the
+	 * queued frames are out. lwIP always leaves the headroom.
+	 */
+	raspi_netdev_tx_drain(queue);
+	raspi_net_tx_csum(pkt, 0);
+	ok = USPiSendFrame((const void *)pkt->data, pkt->len);
+#elif defined(CONFIG_RASPI_NET_TX_BATCH)
+	if (unlikely(raspi_net_tx_is_tso(pkt))) {
+		/* Larger than a batch, the pending one goes out first */
+		raspi_net_tx_flush_locked();
+		ok = USPiSendFrameInPlace(pkt->data, pkt->len,
+					  raspi_net_tx_csum(pkt, 1));
+	} else {
+		/* A full batch is sent by USPiQueueFrame itself */
+		if (!tx_batch_start) {
+			tx_batch_start = get_system_timer();
+			uk_semaphore_up(&tx_batch_started);
+		}
+		ok = USPiQueueFrame((const void *)pkt->data, pkt->len,
+				    raspi_net_tx_csum(pkt, 1));
+	}
+#else
+	if (likely(raspi_net_tx_in_place(pkt)))
+		ok = USPiSendFrameInPlace(pkt->data, pkt->len,
+					  raspi_net_tx_csum(pkt, 1));
+	else {
+		raspi_net_tx_csum(pkt, 0);
+		ok = USPiSendFrame((const void *)pkt->data, pkt->len);
+	}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TSO
+out:
+#endif
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	uk_semaphore_up(&tx_batch_lock);
+#endif
+	if (!ok) {
 		uk_pr_err("Failed to send frame\n");
 		return -1;
 	}
@@ -159,11 +916,79 @@ static const struct uk_hwaddr *raspi_net_mac_get(struct uk_netdev *n)
 	return &d->hw_addr;
 }
 
-static unsigned raspi_net_promisc_get(struct uk_netdev *n __unused)
+static unsigned raspi_net_promisc_get(struct uk_netdev *n)
 {
+	UK_ASSERT(n);
+
+	return to_raspinetdev(n)->promisc;
+}
+
+/* Programs promiscuous mode and the multicast list into the device */
+static int raspi_net_rx_filter_apply(struct raspi_net_device *d)
+{
+	unsigned flags = 0;
+
+	if (d->promisc)
+		flags |= USPI_RX_PROMISC;
+	if (d->allmulti)
+		flags |= USPI_RX_ALLMULTI;
+
+	if (!USPiEthernetSetRxFilter(flags, &d->mcast[0][0], d->mcast_count)) {
+		uk_pr_err("Failed to set the receive filter\n");
+		return -EIO;
+	}
+
 	return 0;
 }
 
+static int raspi_net_promisc_set(struct uk_netdev *n, unsigned mode)
+{
+	struct raspi_net_device *d;
+	int rc = 0;
+
+	UK_ASSERT(n);
+	d = to_raspinetdev(n);
+
+	raspi_net_settings_lock(d);
+	/* Before the bring-up the device gets it once enumerated */
+	d->promisc = mode ? 1 : 0;
+	if (raspi_net_hw_up(d))
+		rc = raspi_net_rx_filter_apply(d);
+	raspi_net_settings_unlock(d);
+
+	return rc;
+}
+
+int raspi_net_mcast_set(struct uk_netdev *n, const struct uk_hwaddr *addrs,
+			unsigned count)
+{
+	struct raspi_net_device *d;
+	unsigned i;
+	int rc = 0;
+
+	UK_ASSERT(n);
+	UK_ASSERT(addrs || !count);
+	d = to_raspinetdev(n);
+
+	raspi_net_settings_lock(d);
+	if (count > RASPI_NET_MAX_MCAST) {
+		d->allmulti = 1;
+		d->mcast_count = 0;
+	} else {
+		for (i = 0; i < count; i++)
+			memcpy(d->mcast[i], addrs[i].addr_bytes,
+			       UK_NETDEV_HWADDR_LEN);
+		d->allmulti = 0;
+		d->mcast_count = count;
+	}
+
+	if (raspi_net_hw_up(d))
+		rc = raspi_net_rx_filter_apply(d);
+	raspi_net_settings_unlock(d);
+
+	return rc;
+}
+
 static void raspi_net_info_get(struct uk_netdev *dev,
 				struct uk_netdev_info *dev_info)
 {
@@ -173,18 +998,99 @@ static void raspi_net_info_get(struct uk_netdev *dev,
 	dev_info->max_rx_queues = RASPI_MAX_QUEUE_PAIRS;
 	dev_info->max_tx_queues = RASPI_MAX_QUEUE_PAIRS;
 	dev_info->in_queue_pairs = RASPI_MAX_QUEUE_PAIRS;
-	dev_info->max_mtu = RASPI_NET_MAX_MTU;
+	/* The device is not known before the bring-up */
+	dev_info->max_mtu = raspi_net_hw_up(to_raspinetdev(dev))
+			    ? USPiEthernetMaxMTU() : RASPI_NET_MAX_MTU;
 	dev_info->ioalign = RASPI_PKT_BUFFER_ALIGN;
 
-	dev_info->nb_encap_tx = 0;
+	dev_info->nb_encap_tx = USPI_FRAME_TX_HEADROOM;
 	dev_info->nb_encap_rx = 0;
 
-	dev_info->features = 0x0; // TODO: Check what features we can implement
+	dev_info->features = 0x0;
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	dev_info->features |= UK_NETDEV_F_RXQ_INTR;
+#endif
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+	/* Only a LAN7800 inserts the checksums, it is known after bring-up */
+	if (raspi_net_hw_up(to_raspinetdev(dev))
+	    && USPiEthernetChecksumOffload())
+		dev_info->features |= UK_NETDEV_F_PARTIAL_CSUM;
+#endif
+#ifdef CONFIG_RASPI_NET_TSO
+	/* Only a LAN7800 segments, it is known after bring-up */
+	if (raspi_net_hw_up(to_raspinetdev(dev))
+	    && USPiEthernetSegmentationOffload())
+		dev_info->features |= UK_NETDEV_F_TSO4;
+#endif
 }
 
-static __u16 raspi_net_mtu_get(struct uk_netdev *n __unused)
+static __u16 raspi_net_mtu_get(struct uk_netdev *n)
 {
-	return RASPI_NET_MAX_MTU;
+	UK_ASSERT(n);
+
+	return to_raspinetdev(n)->mtu;
+}
+
+/* Programs d->mtu into the device, an SMSC951x falls back to its maximum */
+static int raspi_net_mtu_apply(struct raspi_net_device *d)
+{
+	__u16 mtu = d->mtu;
+
+	if (mtu > USPiEthernetMaxMTU()) {
+		uk_pr_warn("MTU %"__PRIu16" not supported, using %d\n",
+			   mtu, USPiEthernetMaxMTU());
+		mtu = USPiEthernetMaxMTU();
+		d->mtu = mtu;
+	}
+
+	if (!USPiEthernetSetMTU(mtu)) {
+		uk_pr_err("Failed to set MTU %"__PRIu16"\n", mtu);
+		return -EIO;
+	}
+
+	/* Receives posted from now on are sized for the new mtu */
+	__atomic_store_n(&d->rx_size, USPiEthernetRxBufferSize(mtu),
+			 __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static int raspi_net_mtu_set(struct uk_netdev *n, __u16 mtu)
+{
+	struct raspi_net_device *d;
+	int rc = 0;
+
+	UK_ASSERT(n);
+	d = to_raspinetdev(n);
+
+	raspi_net_settings_lock(d);
+	if (unlikely(mtu < RASPI_NET_MIN_MTU || mtu > RASPI_NET_MAX_MTU
+		     || (raspi_net_hw_up(d) && mtu > USPiEthernetMaxMTU()))) {
+		uk_pr_err("Invalid MTU %"__PRIu16"\n", mtu);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	/* Before the bring-up the device gets it once enumerated */
+	d->mtu = mtu;
+	if (raspi_net_hw_up(d))
+		rc = raspi_net_mtu_apply(d);
+out:
+	raspi_net_settings_unlock(d);
+
+	return rc;
+}
+
+/* Programs what was set before the bring-up into the device */
+static int raspi_net_settings_apply(struct raspi_net_device *d)
+{
+	int rc;
+
+	rc = raspi_net_mtu_apply(d);
+	if (rc < 0)
+		return rc;
+
+	return raspi_net_rx_filter_apply(d);
 }
 
 static int raspi_netdev_txq_info_get(struct uk_netdev *dev,
@@ -271,6 +1177,25 @@ static int raspi_netdev_queue_setup(struct raspi_net_device *rndev,
 	nr_desc = (nr_desc != 0) ? nr_desc : max_desc;
 	uk_pr_debug("Configuring the %d descriptors\n", nr_desc);
 
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	/* Every posted receive must find room in the ring when it completes */
+	if (unlikely(queue_type == RNET_RX
+		     && nr_desc <= CONFIG_RASPI_NET_RX_INTR_URBS)) {
+		uk_pr_err("Expect more than %d rx descriptors\n",
+			  CONFIG_RASPI_NET_RX_INTR_URBS);
+		return -EINVAL;
+	}
+#endif
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	/* The done ring is sized for the ring plus the posted transmits */
+	if (unlikely(queue_type == RNET_TX
+		     && nr_desc < CONFIG_RASPI_NET_TX_ASYNC_URBS)) {
+		uk_pr_err("Expect at least %d tx descriptors\n",
+			  CONFIG_RASPI_NET_TX_ASYNC_URBS);
+		return -EINVAL;
+	}
+#endif
+
 	/* Check if the descriptor is a power of 2 */
 	if (unlikely(nr_desc & (nr_desc - 1))) {
 		uk_pr_err("Expect descriptor count as a power 2\n");
@@ -290,6 +1215,19 @@ static int raspi_netdev_queue_setup(struct raspi_net_device *rndev,
 		rndev->rxqs[id].rq = rq;
 		rndev->rxqs[id].nb_desc = nr_desc;
 	} else {
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+		struct uk_ring *done = uk_ring_alloc(2 * nr_desc, a);
+
+		if (unlikely(PTRISERR(done))) {
+			uk_pr_err("Failed to set up queue %"__PRIu16"\n",
+				  queue_id);
+			uk_ring_free(rq, a);
+			return PTR2ERR(done);
+		}
+		rndev->txqs[id].done = done;
+		for (unsigned i = 0; i < CONFIG_RASPI_NET_TX_ASYNC_URBS; i++)
+			rndev->txqs[id].slots[i].txq = &rndev->txqs[id];
+#endif
 		rndev->txqs[id].rq = rq;
 		rndev->txqs[id].ndev = &rndev->netdev;
 		rndev->txqs[id].nb_desc = nr_desc;
@@ -361,8 +1299,20 @@ static struct raspi_netdev_rx_queue *raspi_netdev_rx_queue_setup(
 	}
 	rxq  = &rndev->rxqs[rc];
 
+	if (!rxq->rx_buf) {
+		rxq->rx_buf = DMAPoolAllocate(RASPI_RX_BUFFER_SIZE);
+		if (unlikely(!rxq->rx_buf)) {
+			rc = -ENOMEM;
+			goto err_exit;
+		}
+	}
+
 	rxq->alloc_rxpkts = conf->alloc_rxpkts;
 	rxq->alloc_rxpkts_argp = conf->alloc_rxpkts_argp;
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	for (unsigned i = 0; i < CONFIG_RASPI_NET_RX_INTR_URBS; i++)
+		rxq->slots[i].rxq = rxq;
+#endif
 exit:
 	return rxq;
 
@@ -380,27 +1330,105 @@ static int raspi_netdev_configure(struct uk_netdev *n __unused,
 	return 0;
 }
 
-static int raspi_net_start(struct uk_netdev *n)
+#ifdef CONFIG_RASPI_NET_BENCH
+#define RASPI_NET_BENCH_FRAME_SIZE 1514
+#define RASPI_NET_BENCH_ETHERTYPE 0x88b5 // IEEE 802 local experimental
+
+static void raspi_net_bench_report(const char *dir, unsigned frames,
+				   uint64_t bytes, uint64_t usecs)
 {
-	struct raspi_net_device *d;
+	if (!usecs)
+		usecs = 1;
+
+	/* Bits per microsecond are Mbit/s */
+	uk_pr_info("raspi-net bench %s: %u frames, %"__PRIu64" bytes in %"__PRIu64" us, "
+		   "%"__PRIu64".%"__PRIu64" Mbit/s\n",
+		   dir, frames, bytes, usecs,
+		   bytes * 8 / usecs, bytes * 80 / usecs % 10);
+}
 
-	UK_ASSERT(n != NULL);
-	d = to_raspinetdev(n);
+/**
+ * Bulk-loop throughput of the USB path, run once the link is up and before
+ * the stack uses the device: CONFIG_RASPI_NET_BENCH_FRAMES full frames are
+ * sent back to back, then frames are received for
+ * CONFIG_RASPI_NET_BENCH_RX_SECONDS.
+ */
+static void raspi_net_bench(struct raspi_net_device *d)
+{
+	unsigned char *frame;
+	unsigned frames, len, i;
+	uint64_t bytes, start;
+
+	frame = DMAPoolAllocate(USPI_FRAME_BUFFER_SIZE);
+	if (unlikely(!frame)) {
+		uk_pr_err("No memory for the raspi-net bench\n");
+		return;
+	}
+
+	/* Addressed to ourselves, a switch does not forward it to other ports */
+	memcpy(frame, d->hw_addr.addr_bytes, UK_NETDEV_HWADDR_LEN);
+	memcpy(frame + UK_NETDEV_HWADDR_LEN, d->hw_addr.addr_bytes,
+	       UK_NETDEV_HWADDR_LEN);
+	frame[12] = RASPI_NET_BENCH_ETHERTYPE >> 8;
+	frame[13] = RASPI_NET_BENCH_ETHERTYPE & 0xff;
+	for (i = 14; i < RASPI_NET_BENCH_FRAME_SIZE; i++)
+		frame[i] = i;
+
+	frames = 0;
+	start = get_system_timer();
+	for (i = 0; i < CONFIG_RASPI_NET_BENCH_FRAMES; i++)
+		if (USPiSendFrame(frame, RASPI_NET_BENCH_FRAME_SIZE))
+			frames++;
+	raspi_net_bench_report("tx", frames,
+			       (uint64_t)frames * RASPI_NET_BENCH_FRAME_SIZE,
+			       get_system_timer() - start);
+
+	frames = 0;
+	bytes = 0;
+	start = get_system_timer();
+	while (get_system_timer() - start
+	       < CONFIG_RASPI_NET_BENCH_RX_SECONDS * 1000000ULL) {
+		if (USPiReceiveFrame(frame, &len)) {
+			frames++;
+			bytes += len;
+		}
+	}
+	raspi_net_bench_report("rx", frames, bytes,
+			       get_system_timer() - start);
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	USPiCycleTraceDump();
+#endif
 
+	DMAPoolFree(frame);
+}
+#endif /* CONFIG_RASPI_NET_BENCH */
+
+/**
+ * Initializes the USB stack, enumerates the Ethernet device and waits for
+ * the link to come up.
+ */
+static int raspi_net_bringup(struct raspi_net_device *d)
+{
+	int bt = raspi_boottrace_begin("usb: environment init");
 	if (!USPiEnvInitialize ())
 	{
 		uk_pr_err("Failed to init USPiEnv.\n");
 
+		raspi_boottrace_end(bt);
 		return -EIO;
 	}
+	raspi_boottrace_end(bt);
 	
+	bt = raspi_boottrace_begin("usb: USPi init");
 	if (!USPiInitialize ())
 	{
 		uk_pr_err("Cannot initialize USPi\n");
 
+		raspi_boottrace_end(bt);
 		USPiEnvClose ();
 		return -EIO;
 	}
+	raspi_boottrace_end(bt);
 
 	if (!USPiEthernetAvailable ())
 	{
@@ -411,11 +1439,15 @@ static int raspi_net_start(struct uk_netdev *n)
 		return -ENXIO;
 	}
 
-	if (!USPiGetMACAddress (&d->hw_addr.addr_bytes)) {
-		uk_pr_err("Failed to get the device hardware address\n");
-		return -EIO;
-	}
+	USPiGetMACAddress (d->hw_addr.addr_bytes);
+
+	/* Nothing may be received with the buffer size of another device,
+	 * the mtu is programmed after this
+	 */
+	__atomic_store_n(&d->rx_size, USPiEthernetRxBufferSize(d->mtu),
+			 __ATOMIC_RELAXED);
 
+	bt = raspi_boottrace_begin("net: link up wait");
 	unsigned nTimeout = 0;
 	while (!USPiEthernetIsLinkUp ())
 	{
@@ -428,12 +1460,149 @@ static int raspi_net_start(struct uk_netdev *n)
 		nTimeout = 0;
 
 		uk_pr_err("Link is down\n");
+		raspi_boottrace_end(bt);
 		return -EIO;
 	}
+	raspi_boottrace_end(bt);
+	raspi_boottrace_dump();
+
+#ifdef CONFIG_RASPI_NET_BENCH
+	/* Before any receive is posted, this holds the link down meanwhile */
+	raspi_net_bench(d);
+#endif
+
+	return 0;
+}
+
+/* Programs the settings and starts receiving, the data path is not yet used */
+static int raspi_net_bringup_finish(struct raspi_net_device *d)
+{
+	int rc;
+
+	rc = raspi_net_settings_apply(d);
+	if (rc < 0)
+		return rc;
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	/* From here on frames arrive through the completion routine */
+	if (d->rxqs[0].alloc_rxpkts)
+		raspi_netdev_rx_fillup(&d->rxqs[0]);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	if (unlikely(!uk_sched_thread_create(uk_sched_current(),
+					     raspi_net_tx_flusher, NULL,
+					     "raspi-net-txflush"))) {
+		uk_pr_err("Failed to create the raspi-net TX flush thread\n");
+		return -ENOMEM;
+	}
+#endif
 
 	return 0;
 }
 
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+static void raspi_net_link_notify(struct raspi_net_device *d)
+{
+	raspi_net_link_cb_t cb = __atomic_load_n(&d->link_cb, __ATOMIC_SEQ_CST);
+
+	if (!cb || __atomic_load_n(&d->link_state, __ATOMIC_SEQ_CST) == RASPI_LINK_PENDING)
+		return;
+
+	/* Both the bring-up thread and raspi_net_link_cb_set() may get here */
+	if (__atomic_exchange_n(&d->link_notified, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	cb(&d->netdev, d->link_state == RASPI_LINK_UP, d->link_cb_argp);
+}
+
+static void raspi_net_bringup_thread(void *arg)
+{
+	struct raspi_net_device *d = arg;
+	int rc;
+
+	rc = raspi_net_bringup(d);
+
+	/* A setter either stored its change before, then it is applied here,
+	 * or it waits and finds the link up
+	 */
+	raspi_net_settings_lock(d);
+	if (rc == 0)
+		rc = raspi_net_bringup_finish(d);
+	__atomic_store_n(&d->link_state, rc < 0 ? RASPI_LINK_FAILED : RASPI_LINK_UP,
+			 __ATOMIC_SEQ_CST);
+	raspi_net_settings_unlock(d);
+
+	if (rc < 0)
+		uk_pr_err("raspi-net bring-up failed: %d\n", rc);
+	else
+		uk_pr_info("raspi-net link is up\n");
+
+	uk_semaphore_up(&d->link_sem);
+	raspi_net_link_notify(d);
+}
+
+void raspi_net_link_cb_set(raspi_net_link_cb_t cb, void *argp)
+{
+	struct raspi_net_device *d = raspi_ndev;
+
+	UK_ASSERT(d);
+
+	d->link_cb_argp = argp;
+	__atomic_store_n(&d->link_cb, cb, __ATOMIC_SEQ_CST);
+	raspi_net_link_notify(d);
+}
+
+int raspi_net_link_wait(void)
+{
+	struct raspi_net_device *d = raspi_ndev;
+
+	UK_ASSERT(d);
+
+	/* Pass the token on so every waiter gets through */
+	uk_semaphore_down(&d->link_sem);
+	uk_semaphore_up(&d->link_sem);
+
+	return raspi_net_ready(d);
+}
+#endif /* CONFIG_RASPI_NET_ASYNC_START */
+
+static int raspi_net_start(struct uk_netdev *n)
+{
+	struct raspi_net_device *d;
+
+	UK_ASSERT(n != NULL);
+	d = to_raspinetdev(n);
+
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	struct uk_thread *t;
+
+	/* The board MAC comes from the firmware, so the stack can be
+	 * configured before the USB device shows up.
+	 */
+	if (!GetMACAddress (d->hw_addr.addr_bytes)) {
+		uk_pr_err("Failed to get the board hardware address\n");
+		return -EIO;
+	}
+
+	t = uk_sched_thread_create(uk_sched_current(), raspi_net_bringup_thread,
+				   d, "raspi-net-bringup");
+	if (unlikely(!t)) {
+		uk_pr_err("Failed to create the raspi-net bring-up thread\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+#else
+	int rc;
+
+	rc = raspi_net_bringup(d);
+	if (rc < 0)
+		return rc;
+
+	return raspi_net_bringup_finish(d);
+#endif
+}
 
 static const struct uk_netdev_ops raspi_netdev_ops = {
 	// TODO: If we enable some of the optional features we might need to use this?
@@ -442,13 +1611,16 @@ static const struct uk_netdev_ops raspi_netdev_ops = {
 	.rxq_configure = raspi_netdev_rx_queue_setup,
 	.txq_configure = raspi_netdev_tx_queue_setup,
 	.start = raspi_net_start,
-	// TODO: If we enable the rx and tx interrupt features (also in raspi_net_info_get) we should actually update these
-	// .rxq_intr_enable = ,
-	// .rxq_intr_disable = ,
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	.rxq_intr_enable = raspi_netdev_rxq_intr_enable,
+	.rxq_intr_disable = raspi_netdev_rxq_intr_disable,
+#endif
 	.info_get = raspi_net_info_get,
 	.promiscuous_get = raspi_net_promisc_get,
+	.promiscuous_set = raspi_net_promisc_set,
 	.hwaddr_get = raspi_net_mac_get,
 	.mtu_get = raspi_net_mtu_get,
+	.mtu_set = raspi_net_mtu_set,
 	.txq_info_get = raspi_netdev_txq_info_get,
 	.rxq_info_get = raspi_netdev_rxq_info_get,
 };
@@ -475,8 +1647,17 @@ static int raspi_net_add_dev()
 		goto err_netdev_data;
 	}
 	rndev->uid = rc;
+	rndev->mtu = RASPI_NET_DEFAULT_MTU;
+	rndev->rx_size = RASPI_RX_BUFFER_SIZE;
 	rc = 0;
 
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+	rndev->link_state = RASPI_LINK_PENDING;
+	uk_semaphore_init(&rndev->link_sem, 0);
+	uk_semaphore_init(&rndev->settings_sem, 1);
+	raspi_ndev = rndev;
+#endif
+
 	uk_pr_debug("raspi-net device registered with libuknet\n");
 
 exit:
@@ -489,19 +1670,22 @@ err_out:
 
 static int rasp_net_register(struct uk_init_ctx *ictx) {
 	int rc;
+	int bt = raspi_boottrace_begin("initcall: raspi-net register");
     uk_pr_err("Registering raspi net dev.\n");
 	rc = rasp_net_drv_init(uk_alloc_get_default());
 	if (rc < 0) {
 		uk_pr_err("Failed to init raspi-net device\n");
-		return rc;
+		goto out;
 	}
 
 	rc = raspi_net_add_dev();
 	if (rc < 0) {
 		uk_pr_err("Failed to register raspi-net device with libuknet\n");
-		return rc;
+		goto out;
 	}
 
+out:
+	raspi_boottrace_end(bt);
 	return rc;
 }
 
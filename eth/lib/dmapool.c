@@ -0,0 +1,180 @@
+//
+// dmapool.c
+//
+// USPi - An USB driver for Raspberry Pi written in C
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <uspi/dmapool.h>
+#include <uspi/synchronize.h>
+#include <uspi/macros.h>
+#include <uk/assert.h>
+#include <uk/alloc.h>
+#include <uk/arch/lcpu.h>
+#include <raspi/sysregs.h>
+
+//
+// Slab layout inside the non-cacheable window
+//
+#define DMA_POOL_SETUP_SIZE	64		// setup packets, hub and port status
+#define DMA_POOL_SETUP_COUNT	512
+#define DMA_POOL_DESC_SIZE	512		// descriptors, control transfer data
+#define DMA_POOL_DESC_COUNT	128
+#define DMA_POOL_FRAME_SIZE	2048		// Ethernet frame buffers
+#define DMA_POOL_FRAME_COUNT	512
+
+#ifdef CONFIG_RASPI_NET_JUMBO
+#define DMA_POOL_JUMBO_SIZE	9216		// LAN7800 jumbo frame buffers
+#define DMA_POOL_JUMBO_COUNT	32
+#define DMA_POOL_CLASSES	4
+#else
+#define DMA_POOL_CLASSES	3
+#endif
+#define DMA_POOL_MAX_SLOTS	512
+
+typedef struct TDMAPoolSlab
+{
+	unsigned nSlotSize;
+	unsigned nSlots;
+	uintptr	 nBase;
+	unsigned nFree;
+	u32	 Map[DMA_POOL_MAX_SLOTS / 32];	// bit set: slot in use
+}
+TDMAPoolSlab;
+
+static TDMAPoolSlab s_Slab[DMA_POOL_CLASSES] =
+{
+	{DMA_POOL_SETUP_SIZE, DMA_POOL_SETUP_COUNT},
+	{DMA_POOL_DESC_SIZE,  DMA_POOL_DESC_COUNT},
+	{DMA_POOL_FRAME_SIZE, DMA_POOL_FRAME_COUNT},
+#ifdef CONFIG_RASPI_NET_JUMBO
+	{DMA_POOL_JUMBO_SIZE, DMA_POOL_JUMBO_COUNT}
+#endif
+};
+
+static uintptr s_nPoolEnd = 0;
+
+static void DMAPoolInitialize (void)
+{
+	uintptr nBase = DMA_NC_BASE;
+
+	for (unsigned i = 0; i < DMA_POOL_CLASSES; i++)
+	{
+		TDMAPoolSlab *pSlab = &s_Slab[i];
+
+		UK_ASSERT (pSlab->nSlots <= DMA_POOL_MAX_SLOTS);
+		UK_ASSERT ((pSlab->nSlotSize & (DMA_POOL_ALIGN-1)) == 0);
+
+		pSlab->nBase = nBase;
+		pSlab->nFree = pSlab->nSlots;
+		nBase += pSlab->nSlotSize * pSlab->nSlots;
+	}
+
+	UK_ASSERT (nBase <= DMA_NC_END);
+	s_nPoolEnd = nBase;
+}
+
+static void *DMAPoolSlabAllocate (TDMAPoolSlab *pSlab)
+{
+	if (pSlab->nFree == 0)
+	{
+		return 0;
+	}
+
+	for (unsigned nWord = 0; nWord < pSlab->nSlots / 32; nWord++)
+	{
+		u32 nMap = pSlab->Map[nWord];
+		if (nMap == 0xFFFFFFFF)
+		{
+			continue;
+		}
+
+		unsigned nBit = __builtin_ctz (~nMap);
+		pSlab->Map[nWord] |= 1U << nBit;
+		pSlab->nFree--;
+
+		return (void *) (pSlab->nBase + (nWord * 32 + nBit) * pSlab->nSlotSize);
+	}
+
+	return 0;
+}
+
+void *DMAPoolAllocate (unsigned nSize)
+{
+	void *pBuffer = 0;
+
+	uspi_EnterCritical ();
+
+	if (s_nPoolEnd == 0)
+	{
+		DMAPoolInitialize ();
+	}
+
+	for (unsigned i = 0; i < DMA_POOL_CLASSES && pBuffer == 0; i++)
+	{
+		if (nSize <= s_Slab[i].nSlotSize)
+		{
+			pBuffer = DMAPoolSlabAllocate (&s_Slab[i]);
+		}
+	}
+
+	uspi_LeaveCritical ();
+
+	if (pBuffer == 0)
+	{
+		// keep the fallback cache-line aligned too, the DWHCI driver cleans
+		// and invalidates whole lines around cacheable transfer buffers
+		pBuffer = uk_memalign (uk_alloc_get_default (), CACHE_LINE_SIZE, nSize);
+	}
+
+	return pBuffer;
+}
+
+void DMAPoolFree (void *pBuffer)
+{
+	uintptr nAddress = (uintptr) pBuffer;
+
+	if (!DMAPoolContains (nAddress))
+	{
+		uk_free (uk_alloc_get_default (), pBuffer);
+
+		return;
+	}
+
+	uspi_EnterCritical ();
+
+	for (unsigned i = 0; i < DMA_POOL_CLASSES; i++)
+	{
+		TDMAPoolSlab *pSlab = &s_Slab[i];
+
+		if (   nAddress >= pSlab->nBase
+		    && nAddress < pSlab->nBase + pSlab->nSlotSize * pSlab->nSlots)
+		{
+			unsigned nSlot = (nAddress - pSlab->nBase) / pSlab->nSlotSize;
+			UK_ASSERT (pSlab->Map[nSlot / 32] & (1U << (nSlot % 32)));
+
+			pSlab->Map[nSlot / 32] &= ~(1U << (nSlot % 32));
+			pSlab->nFree++;
+
+			break;
+		}
+	}
+
+	uspi_LeaveCritical ();
+}
+
+boolean DMAPoolContains (uintptr nAddress)
+{
+	return nAddress >= DMA_NC_BASE && nAddress < DMA_NC_END;
+}
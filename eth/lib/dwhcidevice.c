@@ -23,6 +23,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <uspi/dwhcidevice.h>
+#include <uspi/dmapool.h>
 #include <uspios.h>
 #include <uspi/bcm2835.h>
 #include <uspi/synchronize.h>
@@ -30,6 +31,11 @@
 #include <uspienv/interrupt.h>
 #include <uk/assert.h>
 #include <raspi/irq.h>
+#include <raspi/boottrace.h>
+#include <uk/print.h>
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+#include <uk/thread.h>
+#endif
 
 #define ARM_IRQ_USB		9		// for ConnectInterrupt()
 
@@ -39,12 +45,125 @@
 // Configuration
 //
 #define DWC_CFG_DYNAMIC_FIFO				// re-program FIFOs with these sizes:
+#ifdef CONFIG_RASPI_USB_RX_FIFO_SIZE
+	#define DWC_CFG_HOST_RX_FIFO_SIZE	CONFIG_RASPI_USB_RX_FIFO_SIZE
+	#define DWC_CFG_HOST_NPER_TX_FIFO_SIZE	CONFIG_RASPI_USB_NPER_TX_FIFO_SIZE
+	#define DWC_CFG_HOST_PER_TX_FIFO_SIZE	CONFIG_RASPI_USB_PER_TX_FIFO_SIZE
+#else
 	#define DWC_CFG_HOST_RX_FIFO_SIZE	1024	// number of 32 bit words
 	#define DWC_CFG_HOST_NPER_TX_FIFO_SIZE	1024	// number of 32 bit words
 	#define DWC_CFG_HOST_PER_TX_FIFO_SIZE	1024	// number of 32 bit words
+#endif
+
+#ifdef CONFIG_RASPI_USB_BULK_MULTI_CNT
+#define DWC_CFG_BULK_MULTI_CNT		CONFIG_RASPI_USB_BULK_MULTI_CNT	// packets per DMA arbitration
+#else
+#define DWC_CFG_BULK_MULTI_CNT		1
+#endif
 
 #define MSEC2HZ(msec)		((msec) * HZ / 1000)
 
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+
+// CPU cycles (PMCCNTR_EL0) spent in the channel start and interrupt paths
+typedef struct TDWHCICycleStat
+{
+	const char	*pName;
+	u64		nCount;
+	u64		nTotal;
+	u64		nMin;
+	u64		nMax;
+}
+TDWHCICycleStat;
+
+static TDWHCICycleStat s_CycleStart	= {"bulk channel start"};
+static TDWHCICycleStat s_CycleTransfer	= {"bulk start to interrupt"};
+static TDWHCICycleStat s_CycleInterrupt	= {"interrupt handler"};
+
+static u64 s_nChannelStarted[DWHCI_MAX_CHANNELS];	// 0 if no bulk transfer is timed
+
+static inline u64 DWHCICycles (void)
+{
+	u64 nCycles;
+	__asm__ __volatile__ ("isb; mrs %0, pmccntr_el0" : "=r" (nCycles));
+
+	return nCycles;
+}
+
+// PMCCNTR_EL0 is per core and enabled on the one calling DWHCIDeviceInitialize
+// (the boot CPU), the USB interrupt must be taken on that core too
+static void DWHCICycleTraceInit (void)
+{
+	u64 nValue;
+	__asm__ __volatile__ ("mrs %0, pmcr_el0" : "=r" (nValue));
+	nValue |= 1 << 0;				// E: enable counters
+	__asm__ __volatile__ ("msr pmcr_el0, %0" : : "r" (nValue));
+	__asm__ __volatile__ ("msr pmcntenset_el0, %0" : : "r" (1UL << 31));
+	__asm__ __volatile__ ("isb");
+}
+
+static void DWHCICycleStatAdd (TDWHCICycleStat *pStat, u64 nCycles)
+{
+	uspi_EnterCritical ();
+
+	if (pStat->nCount == 0 || nCycles < pStat->nMin)
+	{
+		pStat->nMin = nCycles;
+	}
+	if (nCycles > pStat->nMax)
+	{
+		pStat->nMax = nCycles;
+	}
+	pStat->nTotal += nCycles;
+	pStat->nCount++;
+
+	uspi_LeaveCritical ();
+}
+
+static void DWHCICycleStatDump (TDWHCICycleStat *pStat)
+{
+	uspi_EnterCritical ();
+	TDWHCICycleStat Stat = *pStat;
+	pStat->nCount = 0;
+	pStat->nTotal = 0;
+	pStat->nMax = 0;
+	uspi_LeaveCritical ();
+
+	if (Stat.nCount == 0)
+	{
+		return;
+	}
+
+	uk_pr_info ("usb: %-24s %6lu samples, cycles min %lu avg %lu max %lu\n",
+		    Stat.pName, (unsigned long) Stat.nCount, (unsigned long) Stat.nMin,
+		    (unsigned long) (Stat.nTotal / Stat.nCount), (unsigned long) Stat.nMax);
+}
+
+// called once per timed bulk start, also from interrupt context
+static void DWHCICycleTraceStart (unsigned nChannel, u64 nStartCycles)
+{
+	u64 nNow = DWHCICycles ();
+	s_nChannelStarted[nChannel] = nNow;
+
+	DWHCICycleStatAdd (&s_CycleStart, nNow - nStartCycles);
+}
+
+void DWHCIDeviceCycleTraceDump (void)
+{
+	uspi_EnterCritical ();
+	boolean bDue = s_CycleStart.nCount >= CONFIG_RASPI_USB_CYCLE_TRACE_SAMPLES ? TRUE : FALSE;
+	uspi_LeaveCritical ();
+
+	if (bDue)
+	{
+		DWHCICycleStatDump (&s_CycleStart);
+		DWHCICycleStatDump (&s_CycleTransfer);
+		DWHCICycleStatDump (&s_CycleInterrupt);
+	}
+}
+
+#endif
+
 typedef enum
 {
 	StageStateNoSplitTransfer,
@@ -77,13 +196,19 @@ void DWHCIDeviceFlushRxFIFO (TDWHCIDevice *pThis);
 boolean DWHCIDeviceTransferStage (TDWHCIDevice *pThis, TUSBRequest *pURB, boolean bIn, boolean bStatusStage);
 void DWHCIDeviceCompletionRoutine (TUSBRequest *pURB, void *pParam, void *pContext);
 boolean DWHCIDeviceTransferStageAsync (TDWHCIDevice *pThis, TUSBRequest *pURB, boolean bIn, boolean bStatusStage);
+boolean DWHCIDeviceStartStage (TDWHCIDevice *pThis, unsigned nChannel, TUSBRequest *pURB, boolean bIn, boolean bStatusStage);
+void DWHCIDeviceReleaseChannel (TDWHCIDevice *pThis, unsigned nChannel, TUSBEndpoint *pEndpoint);
 void DWHCIDeviceStartTransaction (TDWHCIDevice *pThis, TDWHCITransferStageData *pStageData);
 void DWHCIDeviceStartChannel (TDWHCIDevice *pThis, TDWHCITransferStageData *pStageData);
 void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel);
 void DWHCIDeviceInterruptHandler (void *pParam);
 void DWHCIDeviceTimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
-unsigned DWHCIDeviceAllocateChannel (TDWHCIDevice *pThis);
+unsigned DWHCIDeviceAllocateChannel (TDWHCIDevice *pThis, boolean bControl);
 void DWHCIDeviceFreeChannel (TDWHCIDevice *pThis, unsigned nChannel);
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+unsigned DWHCIDeviceAllocateBoundChannel (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint);
+void DWHCIDeviceStartBoundChannel (TDWHCIDevice *pThis, TDWHCITransferStageData *pStageData);
+#endif
 boolean DWHCIDeviceWaitForBit (TDWHCIDevice *pThis, TDWHCIRegister *pRegister, u32 nMask,boolean bWaitUntilSet, unsigned nMsTimeout);
 #ifndef NDEBUG
 void DWHCIDeviceDumpRegister (TDWHCIDevice *pThis, const char *pName, u32 nAddress);
@@ -96,7 +221,14 @@ void DWHCIDevice (TDWHCIDevice *pThis)
 
 	pThis->m_nChannels = 0;
 	pThis->m_nChannelAllocated = 0;
-	pThis->m_bWaiting = FALSE;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	uk_semaphore_init (&pThis->m_TransferSlots, DWHCI_BLOCKING_TRANSFERS);
+#endif
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	pThis->m_nBoundChannels = 0;
+	pThis->m_nBoundChannelMask = 0;
+	pThis->m_nBoundChannelBusy = 0;
+#endif
 	DWHCIRootPort (&pThis->m_RootPort, pThis);
 }
 
@@ -109,6 +241,10 @@ boolean DWHCIDeviceInitialize (TDWHCIDevice *pThis)
 {
 	UK_ASSERT(pThis != 0);
 
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	DWHCICycleTraceInit ();
+#endif
+
 	DataMemBarrier ();
 
 	TDWHCIRegister VendorId;
@@ -120,12 +256,15 @@ boolean DWHCIDeviceInitialize (TDWHCIDevice *pThis)
 		return FALSE;
 	}
 
+	int nTrace = raspi_boottrace_begin ("usb: power on");
 	if (!SetPowerStateOn (DEVICE_ID_USB_HCD))
 	{
 		LogWrite (LOG_ERROR, "Cannot power on");
+		raspi_boottrace_end (nTrace);
 		_DWHCIRegister (&VendorId);
 		return FALSE;
 	}
+	raspi_boottrace_end (nTrace);
 
 	// Disable all interrupts
 	TDWHCIRegister AHBConfig;
@@ -140,41 +279,53 @@ boolean DWHCIDeviceInitialize (TDWHCIDevice *pThis)
 
 	InterruptSystemEnableIRQ(9);
 
+	nTrace = raspi_boottrace_begin ("usb: core init");
 	if (!DWHCIDeviceInitCore (pThis))
 	{
 		LogWrite (LOG_ERROR, "Cannot initialize core");
+		raspi_boottrace_end (nTrace);
 		_DWHCIRegister (&AHBConfig);
 		_DWHCIRegister (&VendorId);
 		return FALSE;
 	}
+	raspi_boottrace_end (nTrace);
 	
 	DWHCIDeviceEnableGlobalInterrupts (pThis);
+	nTrace = raspi_boottrace_begin ("usb: host init");
 	if (!DWHCIDeviceInitHost (pThis))
 	{
 		LogWrite (LOG_ERROR, "Cannot initialize host");
+		raspi_boottrace_end (nTrace);
 		_DWHCIRegister (&AHBConfig);
 		_DWHCIRegister (&VendorId);
 		return FALSE;
 	}
+	raspi_boottrace_end (nTrace);
 
 	// The following calls will fail if there is no device or no supported device connected
 	// to root port. This is not an error because the system may run without an USB device.
 
+	nTrace = raspi_boottrace_begin ("usb: root port enable");
 	if (!DWHCIDeviceEnableRootPort (pThis))
 	{
 		LogWrite (LOG_WARNING, "No device connected to root port");
+		raspi_boottrace_end (nTrace);
 		_DWHCIRegister (&AHBConfig);
 		_DWHCIRegister (&VendorId);
 		return TRUE;
 	}
+	raspi_boottrace_end (nTrace);
 
+	nTrace = raspi_boottrace_begin ("usb: root port enumeration");
 	if (!DWHCIRootPortInitialize (&pThis->m_RootPort))
 	{
 		LogWrite (LOG_WARNING, "Cannot initialize root port");
+		raspi_boottrace_end (nTrace);
 		_DWHCIRegister (&AHBConfig);
 		_DWHCIRegister (&VendorId);
 		return TRUE;
 	}
+	raspi_boottrace_end (nTrace);
 	
 	DataMemBarrier ();
 
@@ -206,7 +357,7 @@ boolean DWHCIDeviceSetAddress (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint, u8
 		return FALSE;
 	}
 	
-	MsDelay (50);		// see USB 2.0 spec (tDSETADDR)
+	MsDelay (USB_TDSETADDR);	// see USB 2.0 spec (tDSETADDR)
 	
 	return TRUE;
 }
@@ -220,7 +371,7 @@ boolean DWHCIDeviceSetConfiguration (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoin
 		return FALSE;
 	}
 	
-	MsDelay (50);
+	MsDelay (USB_TSETCONFIG);
 	
 	return TRUE;
 }
@@ -231,16 +382,17 @@ int DWHCIDeviceControlMessage (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint,
 {
 	UK_ASSERT(pThis != 0);
 
-	TSetupData SetupData ALIGN (4);		// DMA buffer
+	TSetupData *pSetupData = (TSetupData *) DMAPoolAllocate (sizeof (TSetupData));	// DMA buffer
+	UK_ASSERT (pSetupData != 0);
 
-	SetupData.bmRequestType = ucRequestType;
-	SetupData.bRequest      = ucRequest;
-	SetupData.wValue	= usValue;
-	SetupData.wIndex	= usIndex;
-	SetupData.wLength	= usDataSize;
+	pSetupData->bmRequestType = ucRequestType;
+	pSetupData->bRequest      = ucRequest;
+	pSetupData->wValue	  = usValue;
+	pSetupData->wIndex	  = usIndex;
+	pSetupData->wLength	  = usDataSize;
 
 	TUSBRequest URB;
-	USBRequest (&URB, pEndpoint, pData, usDataSize, &SetupData);
+	USBRequest (&URB, pEndpoint, pData, usDataSize, pSetupData);
 
 	int nResult = -1;
 
@@ -251,6 +403,8 @@ int DWHCIDeviceControlMessage (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint,
 	
 	_USBRequest (&URB);
 
+	DMAPoolFree (pSetupData);
+
 	return nResult;
 }
 
@@ -401,6 +555,7 @@ boolean DWHCIDeviceInitCore (TDWHCIDevice *pThis)
 	UK_ASSERT(pThis->m_nChannels == 0);
 	pThis->m_nChannels = DWHCI_CORE_HW_CFG2_NUM_HOST_CHANNELS (DWHCIRegisterGet (&HWConfig2));
 	UK_ASSERT(4 <= pThis->m_nChannels && pThis->m_nChannels <= DWHCI_MAX_CHANNELS);
+	UK_ASSERT(pThis->m_nChannels >= DWHCI_CHANNELS);
 
 	TDWHCIRegister AHBConfig;
 	DWHCIRegister (&AHBConfig, DWHCI_CORE_AHB_CFG);
@@ -459,21 +614,39 @@ boolean DWHCIDeviceInitHost (TDWHCIDevice *pThis)
 	DWHCIRegisterWrite (&HostConfig);
 
 #ifdef DWC_CFG_DYNAMIC_FIFO
-	TDWHCIRegister RxFIFOSize;
-	DWHCIRegister2 (&RxFIFOSize, DWHCI_CORE_RX_FIFO_SIZ, DWC_CFG_HOST_RX_FIFO_SIZE);
-	DWHCIRegisterWrite (&RxFIFOSize);
-	
-	TDWHCIRegister NonPeriodicTxFIFOSize;
-	DWHCIRegister2 (&NonPeriodicTxFIFOSize, DWHCI_CORE_NPER_TX_FIFO_SIZ, 0);
-	DWHCIRegisterOr (&NonPeriodicTxFIFOSize, DWC_CFG_HOST_RX_FIFO_SIZE);
-	DWHCIRegisterOr (&NonPeriodicTxFIFOSize, DWC_CFG_HOST_NPER_TX_FIFO_SIZE << 16);
-	DWHCIRegisterWrite (&NonPeriodicTxFIFOSize);
-	
-	TDWHCIRegister HostPeriodicTxFIFOSize;
-	DWHCIRegister2 (&HostPeriodicTxFIFOSize, DWHCI_CORE_HOST_PER_TX_FIFO_SIZ, 0);
-	DWHCIRegisterOr (&HostPeriodicTxFIFOSize, DWC_CFG_HOST_RX_FIFO_SIZE + DWC_CFG_HOST_NPER_TX_FIFO_SIZE);
-	DWHCIRegisterOr (&HostPeriodicTxFIFOSize, DWC_CFG_HOST_PER_TX_FIFO_SIZE << 16);
-	DWHCIRegisterWrite (&HostPeriodicTxFIFOSize);
+	TDWHCIRegister HWConfig3;
+	DWHCIRegister (&HWConfig3, DWHCI_CORE_HW_CFG3);
+	if (  DWC_CFG_HOST_RX_FIFO_SIZE + DWC_CFG_HOST_NPER_TX_FIFO_SIZE + DWC_CFG_HOST_PER_TX_FIFO_SIZE
+	    > DWHCI_CORE_HW_CFG3_DFIFO_DEPTH (DWHCIRegisterRead (&HWConfig3)))
+	{
+		// LogWrite () drops the format arguments
+		uk_pr_err ("usb: FIFO sizes of %u words exceed %u, keeping defaults\n",
+			   DWC_CFG_HOST_RX_FIFO_SIZE + DWC_CFG_HOST_NPER_TX_FIFO_SIZE + DWC_CFG_HOST_PER_TX_FIFO_SIZE,
+			   (unsigned) DWHCI_CORE_HW_CFG3_DFIFO_DEPTH (DWHCIRegisterGet (&HWConfig3)));
+	}
+	else
+	{
+		TDWHCIRegister RxFIFOSize;
+		DWHCIRegister2 (&RxFIFOSize, DWHCI_CORE_RX_FIFO_SIZ, DWC_CFG_HOST_RX_FIFO_SIZE);
+		DWHCIRegisterWrite (&RxFIFOSize);
+
+		TDWHCIRegister NonPeriodicTxFIFOSize;
+		DWHCIRegister2 (&NonPeriodicTxFIFOSize, DWHCI_CORE_NPER_TX_FIFO_SIZ, 0);
+		DWHCIRegisterOr (&NonPeriodicTxFIFOSize, DWC_CFG_HOST_RX_FIFO_SIZE);
+		DWHCIRegisterOr (&NonPeriodicTxFIFOSize, DWC_CFG_HOST_NPER_TX_FIFO_SIZE << 16);
+		DWHCIRegisterWrite (&NonPeriodicTxFIFOSize);
+
+		TDWHCIRegister HostPeriodicTxFIFOSize;
+		DWHCIRegister2 (&HostPeriodicTxFIFOSize, DWHCI_CORE_HOST_PER_TX_FIFO_SIZ, 0);
+		DWHCIRegisterOr (&HostPeriodicTxFIFOSize, DWC_CFG_HOST_RX_FIFO_SIZE + DWC_CFG_HOST_NPER_TX_FIFO_SIZE);
+		DWHCIRegisterOr (&HostPeriodicTxFIFOSize, DWC_CFG_HOST_PER_TX_FIFO_SIZE << 16);
+		DWHCIRegisterWrite (&HostPeriodicTxFIFOSize);
+
+		_DWHCIRegister (&HostPeriodicTxFIFOSize);
+		_DWHCIRegister (&NonPeriodicTxFIFOSize);
+		_DWHCIRegister (&RxFIFOSize);
+	}
+	_DWHCIRegister (&HWConfig3);
 #endif
 
 	DWHCIDeviceFlushTxFIFO (pThis, 0x10);	 	// Flush all TX FIFOs
@@ -492,11 +665,6 @@ boolean DWHCIDeviceInitHost (TDWHCIDevice *pThis)
 	DWHCIDeviceEnableHostInterrupts (pThis);
 
 	_DWHCIRegister (&HostPort);
-#ifdef DWC_CFG_DYNAMIC_FIFO
-	_DWHCIRegister (&HostPeriodicTxFIFOSize);
-	_DWHCIRegister (&NonPeriodicTxFIFOSize);
-	_DWHCIRegister (&RxFIFOSize);
-#endif
 	_DWHCIRegister (&USBConfig);
 	_DWHCIRegister (&HWConfig2);
 	_DWHCIRegister (&HostConfig);
@@ -518,22 +686,21 @@ boolean DWHCIDeviceEnableRootPort (TDWHCIDevice *pThis)
 		return FALSE;
 	}
 	
-	MsDelay (100);			// see USB 2.0 spec
+	MsDelay (USB_TATTDB);		// see USB 2.0 spec
 
 	DWHCIRegisterRead (&HostPort);
 	DWHCIRegisterAnd (&HostPort, ~DWHCI_HOST_PORT_DEFAULT_MASK);
 	DWHCIRegisterOr (&HostPort, DWHCI_HOST_PORT_RESET);
 	DWHCIRegisterWrite (&HostPort);
 	
-	MsDelay (50);			// see USB 2.0 spec (tDRSTR)
+	MsDelay (USB_TDRSTR);		// see USB 2.0 spec (tDRSTR)
 
 	DWHCIRegisterRead (&HostPort);
 	DWHCIRegisterAnd (&HostPort, ~DWHCI_HOST_PORT_DEFAULT_MASK);
 	DWHCIRegisterAnd (&HostPort, ~DWHCI_HOST_PORT_RESET);
 	DWHCIRegisterWrite (&HostPort);
 
-	// normally 10ms, seems to be too short for some devices
-	MsDelay (20);			// see USB 2.0 spec (tRSTRCY)
+	MsDelay (USB_TRSTRCY);		// see USB 2.0 spec (tRSTRCY)
 
 	_DWHCIRegister (&HostPort);
 
@@ -634,36 +801,36 @@ void DWHCIDeviceEnableChannelInterrupt (TDWHCIDevice *pThis, unsigned nChannel)
 {
 	UK_ASSERT(pThis != 0);
 
-	TDWHCIRegister AllChanInterruptMask;
-	DWHCIRegister (&AllChanInterruptMask, DWHCI_HOST_ALLCHAN_INT_MASK);
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	if (pThis->m_nBoundChannelMask & (1 << nChannel))
+	{
+		return;			// enabled once on binding
+	}
+#endif
 
 	uspi_EnterCritical ();
 
-	DWHCIRegisterRead (&AllChanInterruptMask);
-	DWHCIRegisterOr (&AllChanInterruptMask, 1 << nChannel);
-	DWHCIRegisterWrite (&AllChanInterruptMask);
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_ALLCHAN_INT_MASK), DWHCIRead (DWHCI_REG (DWHCI_HOST_ALLCHAN_INT_MASK)) | 1 << nChannel);
 
 	uspi_LeaveCritical ();
-
-	_DWHCIRegister (&AllChanInterruptMask);
 }
 
 void DWHCIDeviceDisableChannelInterrupt (TDWHCIDevice *pThis, unsigned nChannel)
 {
 	UK_ASSERT(pThis != 0);
 
-	TDWHCIRegister AllChanInterruptMask;
-	DWHCIRegister (&AllChanInterruptMask, DWHCI_HOST_ALLCHAN_INT_MASK);
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	if (pThis->m_nBoundChannelMask & (1 << nChannel))
+	{
+		return;
+	}
+#endif
 
 	uspi_EnterCritical ();
 
-	DWHCIRegisterRead (&AllChanInterruptMask);
-	DWHCIRegisterAnd (&AllChanInterruptMask, ~(1 << nChannel));
-	DWHCIRegisterWrite (&AllChanInterruptMask);
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_ALLCHAN_INT_MASK), DWHCIRead (DWHCI_REG (DWHCI_HOST_ALLCHAN_INT_MASK)) & ~(1 << nChannel));
 
 	uspi_LeaveCritical ();
-	
-	_DWHCIRegister (&AllChanInterruptMask);
 }
 
 void DWHCIDeviceFlushTxFIFO (TDWHCIDevice *pThis, unsigned nFIFO)
@@ -709,17 +876,51 @@ boolean DWHCIDeviceTransferStage (TDWHCIDevice *pThis, TUSBRequest *pURB, boolea
 	UK_ASSERT(pURB != 0);
 	USBRequestSetCompletionRoutine (pURB, DWHCIDeviceCompletionRoutine, 0, pThis);
 
-	UK_ASSERT(!pThis->m_bWaiting);
-	pThis->m_bWaiting = TRUE;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	// other threads run while this one sleeps and may start blocking
+	// transfers on other channels too, up to DWHCI_BLOCKING_TRANSFERS.
+	// Before the first thread exists there is no one to switch to, so
+	// this spins as before.
+	boolean bSleep = uk_thread_current () != 0 ? TRUE : FALSE;
+	if (bSleep)
+	{
+		uk_semaphore_down (&pThis->m_TransferSlots);
+	}
+#endif
+
+	// the completion state is kept in the URB, so each transfer waits for its own
+	UK_ASSERT(!pURB->m_bWaiting);
+	pURB->m_bWaiting = TRUE;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	pURB->m_bSleeping = bSleep;
+#endif
 
 	if (!DWHCIDeviceTransferStageAsync (pThis, pURB, bIn, bStatusStage))
 	{
-		pThis->m_bWaiting = FALSE;
+		pURB->m_bWaiting = FALSE;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+		if (bSleep)
+		{
+			uk_semaphore_up (&pThis->m_TransferSlots);
+		}
+#endif
 
 		return FALSE;
 	}
 
-	while (pThis->m_bWaiting)
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	if (bSleep)
+	{
+		uk_semaphore_down (&pURB->m_Completion);
+		UK_ASSERT(!pURB->m_bWaiting);
+
+		uk_semaphore_up (&pThis->m_TransferSlots);
+
+		return USBRequestGetStatus (pURB);
+	}
+#endif
+
+	while (pURB->m_bWaiting)
 	{
 		// do nothing
 	}
@@ -729,10 +930,21 @@ boolean DWHCIDeviceTransferStage (TDWHCIDevice *pThis, TUSBRequest *pURB, boolea
 
 void DWHCIDeviceCompletionRoutine (TUSBRequest *pURB, void *pParam, void *pContext)
 {
-	TDWHCIDevice *pThis = (TDWHCIDevice *) pContext;
-	UK_ASSERT(pThis != 0);
+	UK_ASSERT(pURB != 0);
+
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	boolean bSleeping = pURB->m_bSleeping;
+#endif
+
+	// a spinning caller may return and release the URB from here on
+	pURB->m_bWaiting = FALSE;
 
-	pThis->m_bWaiting = FALSE;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	if (bSleeping)
+	{
+		uk_semaphore_up (&pURB->m_Completion);
+	}
+#endif
 }
 
 boolean DWHCIDeviceTransferStageAsync (TDWHCIDevice *pThis, TUSBRequest *pURB, boolean bIn, boolean bStatusStage)
@@ -740,12 +952,79 @@ boolean DWHCIDeviceTransferStageAsync (TDWHCIDevice *pThis, TUSBRequest *pURB, b
 	UK_ASSERT(pThis != 0);
 	UK_ASSERT(pURB != 0);
 	
-	unsigned nChannel = DWHCIDeviceAllocateChannel (pThis);
+	TUSBEndpoint *pEndpoint = USBRequestGetEndpoint (pURB);
+	if (USBEndpointGetType (pEndpoint) == EndpointTypeControl)
+	{
+		unsigned nChannel = DWHCIDeviceAllocateChannel (pThis, TRUE);
+		if (nChannel >= pThis->m_nChannels)
+		{
+			return FALSE;
+		}
+
+		if (!DWHCIDeviceStartStage (pThis, nChannel, pURB, bIn, bStatusStage))
+		{
+			DWHCIDeviceFreeChannel (pThis, nChannel);
+
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	// one request per endpoint is on the bus, the others wait for it to complete
+	UK_ASSERT(!bStatusStage);
+	UK_ASSERT(bIn == USBEndpointIsDirectionIn (pEndpoint));
+
+	uspi_EnterCritical ();
+
+	if (!USBEndpointBeginRequest (pEndpoint, pURB))
+	{
+		uspi_LeaveCritical ();
+
+		return TRUE;
+	}
+
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	// a bound endpoint always uses its own channel, further requests
+	// have been queued above until it is free
+	unsigned nChannel = DWHCIDeviceAllocateBoundChannel (pThis, pEndpoint);
+	if (nChannel >= pThis->m_nChannels)
+	{
+		// not bound
+		nChannel = DWHCIDeviceAllocateChannel (pThis, FALSE);
+	}
+#else
+	unsigned nChannel = DWHCIDeviceAllocateChannel (pThis, FALSE);
+#endif
 	if (nChannel >= pThis->m_nChannels)
 	{
+		// nothing can have been queued behind us
+		TUSBRequest *pNext = USBEndpointEndRequest (pEndpoint);
+		UK_ASSERT(pNext == 0);
+		(void) pNext;
+
+		uspi_LeaveCritical ();
+
+		return FALSE;
+	}
+
+	uspi_LeaveCritical ();
+
+	if (!DWHCIDeviceStartStage (pThis, nChannel, pURB, bIn, bStatusStage))
+	{
+		DWHCIDeviceReleaseChannel (pThis, nChannel, pEndpoint);
+
 		return FALSE;
 	}
 
+	return TRUE;
+}
+
+boolean DWHCIDeviceStartStage (TDWHCIDevice *pThis, unsigned nChannel, TUSBRequest *pURB, boolean bIn, boolean bStatusStage)
+{
+	UK_ASSERT(pThis != 0);
+	UK_ASSERT(nChannel < pThis->m_nChannels);
+
 	TDWHCITransferStageData *pStageData = &pThis->m_StageData[nChannel];
 	DWHCITransferStageData (pStageData, nChannel, pURB, bIn, bStatusStage);
 
@@ -763,8 +1042,6 @@ boolean DWHCIDeviceTransferStageAsync (TDWHCIDevice *pThis, TUSBRequest *pURB, b
 
 			_DWHCITransferStageData (pStageData);
 
-			DWHCIDeviceFreeChannel (pThis, nChannel);
-			
 			return FALSE;
 		}
 
@@ -782,6 +1059,46 @@ boolean DWHCIDeviceTransferStageAsync (TDWHCIDevice *pThis, TUSBRequest *pURB, b
 	return TRUE;
 }
 
+void DWHCIDeviceReleaseChannel (TDWHCIDevice *pThis, unsigned nChannel, TUSBEndpoint *pEndpoint)
+{
+	UK_ASSERT(pThis != 0);
+	UK_ASSERT(pEndpoint != 0);
+
+	if (USBEndpointGetType (pEndpoint) == EndpointTypeControl)
+	{
+		DWHCIDeviceFreeChannel (pThis, nChannel);
+
+		return;
+	}
+
+	// hand the channel over to the next request queued on this endpoint,
+	// which takes its PID from where the finished request has left it
+	while (1)
+	{
+		uspi_EnterCritical ();
+
+		TUSBRequest *pNext = USBEndpointEndRequest (pEndpoint);
+		if (pNext == 0)
+		{
+			DWHCIDeviceFreeChannel (pThis, nChannel);
+
+			uspi_LeaveCritical ();
+
+			return;
+		}
+
+		uspi_LeaveCritical ();
+
+		if (DWHCIDeviceStartStage (pThis, nChannel, pNext, USBEndpointIsDirectionIn (pEndpoint), FALSE))
+		{
+			return;
+		}
+
+		USBRequestSetStatus (pNext, 0);
+		USBRequestCallCompletionRoutine (pNext);
+	}
+}
+
 void DWHCIDeviceStartTransaction (TDWHCIDevice *pThis, TDWHCITransferStageData *pStageData)
 {
 	UK_ASSERT(pThis != 0);
@@ -790,35 +1107,39 @@ void DWHCIDeviceStartTransaction (TDWHCIDevice *pThis, TDWHCITransferStageData *
 	unsigned nChannel = DWHCITransferStageDataGetChannelNumber (pStageData);
 	UK_ASSERT(nChannel < pThis->m_nChannels);
 	
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	// a bound channel is only restarted after it has halted
+	if (pThis->m_nBoundChannelMask & (1 << nChannel))
+	{
+		DWHCIDeviceStartBoundChannel (pThis, pStageData);
+
+		return;
+	}
+#endif
+
 	// channel must be disabled, if not already done but controller
-	TDWHCIRegister Character;
-	DWHCIRegister (&Character, DWHCI_HOST_CHAN_CHARACTER (nChannel));
-	DWHCIRegisterRead (&Character);
-	if (DWHCIRegisterIsSet (&Character, DWHCI_HOST_CHAN_CHARACTER_ENABLE))
+	u32 nCharacter = DWHCIRead (DWHCI_REG (DWHCI_HOST_CHAN_CHARACTER (nChannel)));
+	if (nCharacter & DWHCI_HOST_CHAN_CHARACTER_ENABLE)
 	{
 		DWHCITransferStageDataSetSubState (pStageData, StageSubStateWaitForChannelDisable);
 		
-		DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_ENABLE);
-		DWHCIRegisterOr (&Character, DWHCI_HOST_CHAN_CHARACTER_DISABLE);
-		DWHCIRegisterWrite (&Character);
-
-		TDWHCIRegister ChanInterruptMask;
-		DWHCIRegister (&ChanInterruptMask, DWHCI_HOST_CHAN_INT_MASK (nChannel));
-		DWHCIRegisterSet (&ChanInterruptMask, DWHCI_HOST_CHAN_INT_HALTED);
-		DWHCIRegisterWrite (&ChanInterruptMask);
+		nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_ENABLE;
+		nCharacter |= DWHCI_HOST_CHAN_CHARACTER_DISABLE;
+		DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_CHARACTER (nChannel)), nCharacter);
 
-		_DWHCIRegister (&ChanInterruptMask);
+		DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_INT_MASK (nChannel)), DWHCI_HOST_CHAN_INT_HALTED);
 	}
 	else
 	{
 		DWHCIDeviceStartChannel (pThis, pStageData);
 	}
-
-	_DWHCIRegister (&Character);
 }
 
 void DWHCIDeviceStartChannel (TDWHCIDevice *pThis, TDWHCITransferStageData *pStageData)
 {
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	u64 nStartCycles = DWHCICycles ();
+#endif
 	UK_ASSERT(pThis != 0);
 
 	UK_ASSERT(pStageData != 0);
@@ -828,84 +1149,91 @@ void DWHCIDeviceStartChannel (TDWHCIDevice *pThis, TDWHCITransferStageData *pSta
 	DWHCITransferStageDataSetSubState (pStageData, StageSubStateWaitForTransactionComplete);
 
 	// reset all pending channel interrupts
-	TDWHCIRegister ChanInterrupt;
-	DWHCIRegister (&ChanInterrupt, DWHCI_HOST_CHAN_INT (nChannel));
-	DWHCIRegisterSetAll (&ChanInterrupt);
-	DWHCIRegisterWrite (&ChanInterrupt);
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_INT (nChannel)), (u32) -1);
 	
 	// set transfer size, packet count and pid
-	TDWHCIRegister TransferSize;
-	DWHCIRegister2 (&TransferSize, DWHCI_HOST_CHAN_XFER_SIZ (nChannel), 0);
-	DWHCIRegisterOr (&TransferSize, DWHCITransferStageDataGetBytesToTransfer (pStageData) & DWHCI_HOST_CHAN_XFER_SIZ_BYTES__MASK);
-	DWHCIRegisterOr (&TransferSize, (DWHCITransferStageDataGetPacketsToTransfer (pStageData) << DWHCI_HOST_CHAN_XFER_SIZ_PACKETS__SHIFT)
-					& DWHCI_HOST_CHAN_XFER_SIZ_PACKETS__MASK);
-	DWHCIRegisterOr (&TransferSize, DWHCITransferStageDataGetPID (pStageData) << DWHCI_HOST_CHAN_XFER_SIZ_PID__SHIFT);
-	DWHCIRegisterWrite (&TransferSize);
+	u32 nTransferSize = DWHCITransferStageDataGetBytesToTransfer (pStageData) & DWHCI_HOST_CHAN_XFER_SIZ_BYTES__MASK;
+	nTransferSize |= (DWHCITransferStageDataGetPacketsToTransfer (pStageData) << DWHCI_HOST_CHAN_XFER_SIZ_PACKETS__SHIFT)
+			 & DWHCI_HOST_CHAN_XFER_SIZ_PACKETS__MASK;
+	nTransferSize |= DWHCITransferStageDataGetPID (pStageData) << DWHCI_HOST_CHAN_XFER_SIZ_PID__SHIFT;
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_XFER_SIZ (nChannel)), nTransferSize);
 
 	// set DMA address
-	TDWHCIRegister DMAAddress;
-	DWHCIRegister2 (&DMAAddress, DWHCI_HOST_CHAN_DMA_ADDR (nChannel),
-			BUS_ADDRESS (DWHCITransferStageDataGetDMAAddress (pStageData)));
-	DWHCIRegisterWrite (&DMAAddress);
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_DMA_ADDR (nChannel)),
+		    BUS_ADDRESS (DWHCITransferStageDataGetDMAAddress (pStageData)));
 
-	uspi_CleanAndInvalidateDataCacheRange (DWHCITransferStageDataGetDMAAddress (pStageData),
-					       DWHCITransferStageDataGetBytesToTransfer (pStageData));
+	// buffers from the DMA pool are mapped non-cacheable
+	if (!DMAPoolContains (DWHCITransferStageDataGetDMAAddress (pStageData)))
+	{
+		uspi_CleanAndInvalidateDataCacheRange (DWHCITransferStageDataGetDMAAddress (pStageData),
+						       DWHCITransferStageDataGetBytesToTransfer (pStageData));
+	}
 	DataMemBarrier ();
 
 	// set split control
-	TDWHCIRegister SplitControl;
-	DWHCIRegister2 (&SplitControl, DWHCI_HOST_CHAN_SPLIT_CTRL (nChannel), 0);
+	u32 nSplitControl = 0;
 	if (DWHCITransferStageDataIsSplit (pStageData))
 	{
-		DWHCIRegisterOr (&SplitControl, DWHCITransferStageDataGetHubPortAddress (pStageData));
-		DWHCIRegisterOr (&SplitControl,    DWHCITransferStageDataGetHubAddress (pStageData)
-						<< DWHCI_HOST_CHAN_SPLIT_CTRL_HUB_ADDRESS__SHIFT);
-		DWHCIRegisterOr (&SplitControl,    DWHCITransferStageDataGetSplitPosition (pStageData)
-						<< DWHCI_HOST_CHAN_SPLIT_CTRL_XACT_POS__SHIFT);
+		nSplitControl |= DWHCITransferStageDataGetHubPortAddress (pStageData);
+		nSplitControl |=    DWHCITransferStageDataGetHubAddress (pStageData)
+				 << DWHCI_HOST_CHAN_SPLIT_CTRL_HUB_ADDRESS__SHIFT;
+		nSplitControl |=    DWHCITransferStageDataGetSplitPosition (pStageData)
+				 << DWHCI_HOST_CHAN_SPLIT_CTRL_XACT_POS__SHIFT;
 		if (DWHCITransferStageDataIsSplitComplete (pStageData))
 		{
-			DWHCIRegisterOr (&SplitControl, DWHCI_HOST_CHAN_SPLIT_CTRL_COMPLETE_SPLIT);
+			nSplitControl |= DWHCI_HOST_CHAN_SPLIT_CTRL_COMPLETE_SPLIT;
 		}
-		DWHCIRegisterOr (&SplitControl, DWHCI_HOST_CHAN_SPLIT_CTRL_SPLIT_ENABLE);
+		nSplitControl |= DWHCI_HOST_CHAN_SPLIT_CTRL_SPLIT_ENABLE;
 	}
-	DWHCIRegisterWrite (&SplitControl);
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_SPLIT_CTRL (nChannel)), nSplitControl);
 
 	// set channel parameters
-	TDWHCIRegister Character;
-	DWHCIRegister (&Character, DWHCI_HOST_CHAN_CHARACTER (nChannel));
-	DWHCIRegisterRead (&Character);
-	DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_MAX_PKT_SIZ__MASK);
-	DWHCIRegisterOr (&Character, DWHCITransferStageDataGetMaxPacketSize (pStageData) & DWHCI_HOST_CHAN_CHARACTER_MAX_PKT_SIZ__MASK);
-
-	DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_MULTI_CNT__MASK);
-	DWHCIRegisterOr (&Character, 1 << DWHCI_HOST_CHAN_CHARACTER_MULTI_CNT__SHIFT);	// TODO: optimize
+	u32 nCharacter = DWHCIRead (DWHCI_REG (DWHCI_HOST_CHAN_CHARACTER (nChannel)));
+	nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_MAX_PKT_SIZ__MASK;
+	nCharacter |= DWHCITransferStageDataGetMaxPacketSize (pStageData) & DWHCI_HOST_CHAN_CHARACTER_MAX_PKT_SIZ__MASK;
+
+	// for periodic endpoints this is transactions per micro-frame, for
+	// non-periodic ones packets fetched per DMA arbitration
+	nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_MULTI_CNT__MASK;
+	if (DWHCITransferStageDataGetEndpointType (pStageData) == DWHCI_HOST_CHAN_CHARACTER_EP_TYPE_BULK)
+	{
+		nCharacter |= DWC_CFG_BULK_MULTI_CNT << DWHCI_HOST_CHAN_CHARACTER_MULTI_CNT__SHIFT;
+	}
+	else
+	{
+		// control stages are mostly single packets, so fetching more per
+		// arbitration gains nothing. Periodic endpoints get one transaction
+		// per micro-frame, high-bandwidth ones are not supported (the
+		// transaction bits of wMaxPacketSize are masked off above).
+		nCharacter |= 1 << DWHCI_HOST_CHAN_CHARACTER_MULTI_CNT__SHIFT;
+	}
 
 	if (DWHCITransferStageDataIsDirectionIn (pStageData))
 	{
-		DWHCIRegisterOr (&Character, DWHCI_HOST_CHAN_CHARACTER_EP_DIRECTION_IN);
+		nCharacter |= DWHCI_HOST_CHAN_CHARACTER_EP_DIRECTION_IN;
 	}
 	else
 	{
-		DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_EP_DIRECTION_IN);
+		nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_EP_DIRECTION_IN;
 	}
 
 	if (DWHCITransferStageDataGetSpeed (pStageData) == USBSpeedLow)
 	{
-		DWHCIRegisterOr (&Character, DWHCI_HOST_CHAN_CHARACTER_LOW_SPEED_DEVICE);
+		nCharacter |= DWHCI_HOST_CHAN_CHARACTER_LOW_SPEED_DEVICE;
 	}
 	else
 	{
-		DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_LOW_SPEED_DEVICE);
+		nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_LOW_SPEED_DEVICE;
 	}
 
-	DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_DEVICE_ADDRESS__MASK);
-	DWHCIRegisterOr (&Character, DWHCITransferStageDataGetDeviceAddress (pStageData) << DWHCI_HOST_CHAN_CHARACTER_DEVICE_ADDRESS__SHIFT);
+	nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_DEVICE_ADDRESS__MASK;
+	nCharacter |= DWHCITransferStageDataGetDeviceAddress (pStageData) << DWHCI_HOST_CHAN_CHARACTER_DEVICE_ADDRESS__SHIFT;
 
-	DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_EP_TYPE__MASK);
-	DWHCIRegisterOr (&Character, DWHCITransferStageDataGetEndpointType (pStageData) << DWHCI_HOST_CHAN_CHARACTER_EP_TYPE__SHIFT);
+	nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_EP_TYPE__MASK;
+	nCharacter |= DWHCITransferStageDataGetEndpointType (pStageData) << DWHCI_HOST_CHAN_CHARACTER_EP_TYPE__SHIFT;
 
-	DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_EP_NUMBER__MASK);
-	DWHCIRegisterOr (&Character, DWHCITransferStageDataGetEndpointNumber (pStageData) << DWHCI_HOST_CHAN_CHARACTER_EP_NUMBER__SHIFT);
+	nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_EP_NUMBER__MASK;
+	nCharacter |= DWHCITransferStageDataGetEndpointNumber (pStageData) << DWHCI_HOST_CHAN_CHARACTER_EP_NUMBER__SHIFT;
 
 	TDWHCIFrameScheduler *pFrameScheduler = DWHCITransferStageDataGetFrameScheduler (pStageData);
 	if (pFrameScheduler != 0)
@@ -914,31 +1242,86 @@ void DWHCIDeviceStartChannel (TDWHCIDevice *pThis, TDWHCITransferStageData *pSta
 
 		if (pFrameScheduler->IsOddFrame (pFrameScheduler))
 		{
-			DWHCIRegisterOr (&Character, DWHCI_HOST_CHAN_CHARACTER_PER_ODD_FRAME);
+			nCharacter |= DWHCI_HOST_CHAN_CHARACTER_PER_ODD_FRAME;
 		}
 		else
 		{
-			DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_PER_ODD_FRAME);
+			nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_PER_ODD_FRAME;
 		}
 	}
 
-	TDWHCIRegister ChanInterruptMask;
-	DWHCIRegister (&ChanInterruptMask, DWHCI_HOST_CHAN_INT_MASK (nChannel));
-	DWHCIRegisterSet (&ChanInterruptMask, DWHCITransferStageDataGetStatusMask (pStageData));
-	DWHCIRegisterWrite (&ChanInterruptMask);
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_INT_MASK (nChannel)), DWHCITransferStageDataGetStatusMask (pStageData));
 
-	DWHCIRegisterOr (&Character, DWHCI_HOST_CHAN_CHARACTER_ENABLE);
-	DWHCIRegisterAnd (&Character, ~DWHCI_HOST_CHAN_CHARACTER_DISABLE);
-	DWHCIRegisterWrite (&Character);
+	nCharacter |= DWHCI_HOST_CHAN_CHARACTER_ENABLE;
+	nCharacter &= ~DWHCI_HOST_CHAN_CHARACTER_DISABLE;
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_CHARACTER (nChannel)), nCharacter);
 
-	_DWHCIRegister (&ChanInterruptMask);
-	_DWHCIRegister (&Character);
-	_DWHCIRegister (&SplitControl);
-	_DWHCIRegister (&DMAAddress);
-	_DWHCIRegister (&TransferSize);
-	_DWHCIRegister (&ChanInterrupt);
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	if (DWHCITransferStageDataGetEndpointType (pStageData) == DWHCI_HOST_CHAN_CHARACTER_EP_TYPE_BULK)
+	{
+		DWHCICycleTraceStart (nChannel, nStartCycles);
+	}
+#endif
 }
 
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+
+void DWHCIDeviceStartBoundChannel (TDWHCIDevice *pThis, TDWHCITransferStageData *pStageData)
+{
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	u64 nStartCycles = DWHCICycles ();
+#endif
+	UK_ASSERT(pThis != 0);
+
+	UK_ASSERT(pStageData != 0);
+	unsigned nChannel = DWHCITransferStageDataGetChannelNumber (pStageData);
+	UK_ASSERT(nChannel < pThis->m_nChannels);
+	UK_ASSERT(!DWHCITransferStageDataIsSplit (pStageData));
+
+	const TDWHCIBoundChannel *pBound = 0;
+	for (unsigned i = 0; i < pThis->m_nBoundChannels; i++)
+	{
+		if (pThis->m_BoundChannel[i].nChannel == nChannel)
+		{
+			pBound = &pThis->m_BoundChannel[i];
+
+			break;
+		}
+	}
+	UK_ASSERT(pBound != 0);
+
+	DWHCITransferStageDataSetSubState (pStageData, StageSubStateWaitForTransactionComplete);
+
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_INT (nChannel)), (u32) -1);
+
+	u32 nTransferSize = DWHCITransferStageDataGetBytesToTransfer (pStageData) & DWHCI_HOST_CHAN_XFER_SIZ_BYTES__MASK;
+	nTransferSize |= (DWHCITransferStageDataGetPacketsToTransfer (pStageData) << DWHCI_HOST_CHAN_XFER_SIZ_PACKETS__SHIFT)
+			 & DWHCI_HOST_CHAN_XFER_SIZ_PACKETS__MASK;
+	nTransferSize |= DWHCITransferStageDataGetPID (pStageData) << DWHCI_HOST_CHAN_XFER_SIZ_PID__SHIFT;
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_XFER_SIZ (nChannel)), nTransferSize);
+
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_DMA_ADDR (nChannel)),
+		    BUS_ADDRESS (DWHCITransferStageDataGetDMAAddress (pStageData)));
+
+	if (!DMAPoolContains (DWHCITransferStageDataGetDMAAddress (pStageData)))
+	{
+		uspi_CleanAndInvalidateDataCacheRange (DWHCITransferStageDataGetDMAAddress (pStageData),
+						       DWHCITransferStageDataGetBytesToTransfer (pStageData));
+	}
+	DataMemBarrier ();
+
+	// the interrupt handler clears the mask on each interrupt
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_INT_MASK (nChannel)), DWHCITransferStageDataGetStatusMask (pStageData));
+
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_CHARACTER (nChannel)), pBound->nCharacter | DWHCI_HOST_CHAN_CHARACTER_ENABLE);
+
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	DWHCICycleTraceStart (nChannel, nStartCycles);	// only bulk endpoints are bound
+#endif
+}
+
+#endif
+
 void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 {
 	UK_ASSERT(pThis != 0);
@@ -955,34 +1338,30 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 		return;
 
 	case StageSubStateWaitForTransactionComplete: {
-		uspi_CleanAndInvalidateDataCacheRange (DWHCITransferStageDataGetDMAAddress (pStageData),
-						       DWHCITransferStageDataGetBytesToTransfer (pStageData));
+		if (!DMAPoolContains (DWHCITransferStageDataGetDMAAddress (pStageData)))
+		{
+			uspi_CleanAndInvalidateDataCacheRange (DWHCITransferStageDataGetDMAAddress (pStageData),
+							       DWHCITransferStageDataGetBytesToTransfer (pStageData));
+		}
 		DataMemBarrier ();
 
-		TDWHCIRegister TransferSize;
-		DWHCIRegister (&TransferSize, DWHCI_HOST_CHAN_XFER_SIZ (nChannel));
-		DWHCIRegisterRead (&TransferSize);
-
-		TDWHCIRegister ChanInterrupt;
-		DWHCIRegister (&ChanInterrupt, DWHCI_HOST_CHAN_INT (nChannel));
+		u32 nTransferSize = DWHCIRead (DWHCI_REG (DWHCI_HOST_CHAN_XFER_SIZ (nChannel)));
 
 		// restart halted transaction
-		if (DWHCIRegisterRead (&ChanInterrupt) == DWHCI_HOST_CHAN_INT_HALTED)
+		u32 nChanInterrupt = DWHCIRead (DWHCI_REG (DWHCI_HOST_CHAN_INT (nChannel)));
+		if (nChanInterrupt == DWHCI_HOST_CHAN_INT_HALTED)
 		{
 			DWHCIDeviceStartTransaction (pThis, pStageData);
 			return;
 		}
 
 		UK_ASSERT(   !DWHCITransferStageDataIsPeriodic (pStageData)
-			||    DWHCI_HOST_CHAN_XFER_SIZ_PID (DWHCIRegisterGet (&TransferSize))
+			||    DWHCI_HOST_CHAN_XFER_SIZ_PID (nTransferSize)
 			   != DWHCI_HOST_CHAN_XFER_SIZ_PID_MDATA);
 
-		DWHCITransferStageDataTransactionComplete (pStageData, DWHCIRegisterRead (&ChanInterrupt),
-			DWHCI_HOST_CHAN_XFER_SIZ_PACKETS (DWHCIRegisterGet (&TransferSize)),
-			DWHCIRegisterGet (&TransferSize) & DWHCI_HOST_CHAN_XFER_SIZ_BYTES__MASK);
-
-		_DWHCIRegister (&ChanInterrupt);
-		_DWHCIRegister (&TransferSize);
+		DWHCITransferStageDataTransactionComplete (pStageData, nChanInterrupt,
+			DWHCI_HOST_CHAN_XFER_SIZ_PACKETS (nTransferSize),
+			nTransferSize & DWHCI_HOST_CHAN_XFER_SIZ_BYTES__MASK);
 		} break;
 	
 	default:
@@ -1027,7 +1406,7 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 	
 		_DWHCITransferStageData (pStageData);
 
-		DWHCIDeviceFreeChannel (pThis, nChannel);
+		DWHCIDeviceReleaseChannel (pThis, nChannel, USBRequestGetEndpoint (pURB));
 
 		USBRequestCallCompletionRoutine (pURB);
 		break;
@@ -1046,7 +1425,7 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 
 			_DWHCITransferStageData (pStageData);
 
-			DWHCIDeviceFreeChannel (pThis, nChannel);
+			DWHCIDeviceReleaseChannel (pThis, nChannel, USBRequestGetEndpoint (pURB));
 
 			USBRequestCallCompletionRoutine (pURB);
 			break;
@@ -1077,7 +1456,7 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 
 			_DWHCITransferStageData (pStageData);
 
-			DWHCIDeviceFreeChannel (pThis, nChannel);
+			DWHCIDeviceReleaseChannel (pThis, nChannel, USBRequestGetEndpoint (pURB));
 
 			USBRequestCallCompletionRoutine (pURB);
 			break;
@@ -1102,7 +1481,7 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 
 				_DWHCITransferStageData (pStageData);
 
-				DWHCIDeviceFreeChannel (pThis, nChannel);
+				DWHCIDeviceReleaseChannel (pThis, nChannel, USBRequestGetEndpoint (pURB));
 
 				USBRequestCallCompletionRoutine (pURB);
 				break;
@@ -1138,7 +1517,7 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 
 		_DWHCITransferStageData (pStageData);
 
-		DWHCIDeviceFreeChannel (pThis, nChannel);
+		DWHCIDeviceReleaseChannel (pThis, nChannel, USBRequestGetEndpoint (pURB));
 
 		USBRequestCallCompletionRoutine (pURB);
 		break;
@@ -1151,40 +1530,41 @@ void DWHCIDeviceChannelInterruptHandler (TDWHCIDevice *pThis, unsigned nChannel)
 
 void DWHCIDeviceInterruptHandler (void *pParam)
 {
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	u64 nEntryCycles = DWHCICycles ();
+#endif
 	TDWHCIDevice *pThis = (TDWHCIDevice *) pParam;
 	UK_ASSERT(pThis != 0);
 
 	DataMemBarrier ();
 
-	TDWHCIRegister IntStatus;
-	DWHCIRegister (&IntStatus, DWHCI_CORE_INT_STAT);
-	DWHCIRegisterRead (&IntStatus);
+	u32 nIntStatus = DWHCIRead (DWHCI_REG (DWHCI_CORE_INT_STAT));
 
-	if (DWHCIRegisterGet (&IntStatus) & DWHCI_CORE_INT_STAT_HC_INTR)
+	if (nIntStatus & DWHCI_CORE_INT_STAT_HC_INTR)
 	{
-		TDWHCIRegister AllChanInterrupt;
-		DWHCIRegister (&AllChanInterrupt, DWHCI_HOST_ALLCHAN_INT);
-		DWHCIRegisterRead (&AllChanInterrupt);
-		DWHCIRegisterWrite (&AllChanInterrupt);
+		u32 nAllChanInterrupt = DWHCIRead (DWHCI_REG (DWHCI_HOST_ALLCHAN_INT));
+		DWHCIWrite (DWHCI_REG (DWHCI_HOST_ALLCHAN_INT), nAllChanInterrupt);
 		
 		unsigned nChannelMask = 1;
 		for (unsigned nChannel = 0; nChannel < pThis->m_nChannels; nChannel++)
 		{
-			if (DWHCIRegisterGet (&AllChanInterrupt) & nChannelMask)
+			if (nAllChanInterrupt & nChannelMask)
 			{
-				TDWHCIRegister ChanInterruptMask;
-				DWHCIRegister2 (&ChanInterruptMask, DWHCI_HOST_CHAN_INT_MASK(nChannel), 0);
-				DWHCIRegisterWrite (&ChanInterruptMask);
+				DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_INT_MASK (nChannel)), 0);
+
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+				if (s_nChannelStarted[nChannel] != 0)
+				{
+					DWHCICycleStatAdd (&s_CycleTransfer, nEntryCycles - s_nChannelStarted[nChannel]);
+					s_nChannelStarted[nChannel] = 0;
+				}
+#endif
 				
 				DWHCIDeviceChannelInterruptHandler (pThis, nChannel);
-
-				_DWHCIRegister (&ChanInterruptMask);
 			}
 			
 			nChannelMask <<= 1;
 		}
-
-		_DWHCIRegister (&AllChanInterrupt);
 	}
 #if 0	
 	if (IntStatus.Get () & DWHCI_CORE_INT_STAT_PORT_INTR)
@@ -1203,11 +1583,13 @@ void DWHCIDeviceInterruptHandler (void *pParam)
 		IntStatus.Or (DWHCI_CORE_INT_STAT_PORT_INTR);
 	}
 #endif
-	DWHCIRegisterWrite (&IntStatus);
+	DWHCIWrite (DWHCI_REG (DWHCI_CORE_INT_STAT), nIntStatus);
 
 	DataMemBarrier ();
-	
-	_DWHCIRegister (&IntStatus);
+
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+	DWHCICycleStatAdd (&s_CycleInterrupt, DWHCICycles () - nEntryCycles);
+#endif
 }
 
 void DWHCIDeviceTimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext)
@@ -1243,12 +1625,25 @@ void DWHCIDeviceTimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pCo
 	DataMemBarrier ();
 }
 
-unsigned DWHCIDeviceAllocateChannel (TDWHCIDevice *pThis)
+unsigned DWHCIDeviceAllocateChannel (TDWHCIDevice *pThis, boolean bControl)
 {
 	UK_ASSERT(pThis != 0);
 
 	uspi_EnterCritical ();
 
+	// posted bulk and interrupt requests may hold their channels for long,
+	// the last DWHCI_CONTROL_CHANNELS are left to control transfers
+	if (!bControl)
+	{
+		unsigned nFree = pThis->m_nChannels - __builtin_popcount (pThis->m_nChannelAllocated);
+		if (nFree <= DWHCI_CONTROL_CHANNELS)
+		{
+			uspi_LeaveCritical ();
+
+			return DWHCI_MAX_CHANNELS;
+		}
+	}
+
 	unsigned nChannelMask = 1;
 	for (unsigned nChannel = 0; nChannel < pThis->m_nChannels; nChannel++)
 	{
@@ -1278,12 +1673,108 @@ void DWHCIDeviceFreeChannel (TDWHCIDevice *pThis, unsigned nChannel)
 	
 	uspi_EnterCritical ();
 	
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	if (pThis->m_nBoundChannelMask & nChannelMask)
+	{
+		// stays allocated to its endpoint
+		UK_ASSERT(pThis->m_nBoundChannelBusy & nChannelMask);
+		pThis->m_nBoundChannelBusy &= ~nChannelMask;
+
+		uspi_LeaveCritical ();
+
+		return;
+	}
+#endif
+
 	UK_ASSERT(pThis->m_nChannelAllocated & nChannelMask);
 	pThis->m_nChannelAllocated &= ~nChannelMask;
 	
 	uspi_LeaveCritical ();
 }
 
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+
+boolean DWHCIDeviceBindChannel (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint)
+{
+	UK_ASSERT(pThis != 0);
+	UK_ASSERT(pEndpoint != 0);
+
+	TUSBDevice *pDevice = USBEndpointGetDevice (pEndpoint);
+	UK_ASSERT(pDevice != 0);
+
+	// split transactions and frame scheduling need per transfer setup
+	if (   USBEndpointGetType (pEndpoint) != EndpointTypeBulk
+	    || USBDeviceGetSpeed (pDevice) != USBSpeedHigh
+	    || pThis->m_nBoundChannels >= DWHCI_MAX_BOUND_CHANNELS)
+	{
+		return FALSE;
+	}
+
+	unsigned nChannel = DWHCIDeviceAllocateChannel (pThis, FALSE);
+	if (nChannel >= pThis->m_nChannels)
+	{
+		return FALSE;
+	}
+
+	u32 nCharacter =   (USBEndpointGetMaxPacketSize (pEndpoint) & DWHCI_HOST_CHAN_CHARACTER_MAX_PKT_SIZ__MASK)
+			 | DWC_CFG_BULK_MULTI_CNT << DWHCI_HOST_CHAN_CHARACTER_MULTI_CNT__SHIFT
+			 | USBDeviceGetAddress (pDevice) << DWHCI_HOST_CHAN_CHARACTER_DEVICE_ADDRESS__SHIFT
+			 | DWHCI_HOST_CHAN_CHARACTER_EP_TYPE_BULK << DWHCI_HOST_CHAN_CHARACTER_EP_TYPE__SHIFT
+			 | USBEndpointGetNumber (pEndpoint) << DWHCI_HOST_CHAN_CHARACTER_EP_NUMBER__SHIFT;
+	if (USBEndpointIsDirectionIn (pEndpoint))
+	{
+		nCharacter |= DWHCI_HOST_CHAN_CHARACTER_EP_DIRECTION_IN;
+	}
+
+	DWHCIWrite (DWHCI_REG (DWHCI_HOST_CHAN_SPLIT_CTRL (nChannel)), 0);
+
+	// not yet marked as bound, so this is not skipped
+	DWHCIDeviceEnableChannelInterrupt (pThis, nChannel);
+
+	TDWHCIBoundChannel *pBound = &pThis->m_BoundChannel[pThis->m_nBoundChannels];
+	pBound->pEndpoint = pEndpoint;
+	pBound->nChannel = nChannel;
+	pBound->nCharacter = nCharacter;
+
+	uspi_EnterCritical ();
+
+	pThis->m_nBoundChannels++;
+	pThis->m_nBoundChannelMask |= 1 << nChannel;
+
+	uspi_LeaveCritical ();
+
+	return TRUE;
+}
+
+unsigned DWHCIDeviceAllocateBoundChannel (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint)
+{
+	UK_ASSERT(pThis != 0);
+
+	uspi_EnterCritical ();
+
+	for (unsigned i = 0; i < pThis->m_nBoundChannels; i++)
+	{
+		if (pThis->m_BoundChannel[i].pEndpoint == pEndpoint)
+		{
+			// the endpoint has only one request on the bus
+			unsigned nChannel = pThis->m_BoundChannel[i].nChannel;
+			UK_ASSERT(!(pThis->m_nBoundChannelBusy & (1 << nChannel)));
+
+			pThis->m_nBoundChannelBusy |= 1 << nChannel;
+
+			uspi_LeaveCritical ();
+
+			return nChannel;
+		}
+	}
+
+	uspi_LeaveCritical ();
+
+	return DWHCI_MAX_CHANNELS;
+}
+
+#endif
+
 boolean DWHCIDeviceWaitForBit (TDWHCIDevice *pThis, TDWHCIRegister *pRegister, u32 nMask, boolean bWaitUntilSet, unsigned nMsTimeout)
 {
 	UK_ASSERT(pThis != 0);
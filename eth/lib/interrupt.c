@@ -1,4 +1,5 @@
 #include <uspienv/interrupt.h>
+#include <uspienv/memio.h>
 #include <uspienv/synchronize.h>
 #include <uk/assert.h>
 #define ARM_IO_BASE		0x3F000000
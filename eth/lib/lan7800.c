@@ -23,9 +23,13 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <uspi/lan7800.h>
+#include <uspi/netframe.h>
 #include <uspi/usbhostcontroller.h>
 #include <uspi/devicenameservice.h>
 #include <uspi/util.h>
+#include <uspi/dmapool.h>
+#include <uspi/synchronize.h>
+#include <raspi/string.h>
 #include <uk/assert.h>
 #include <uspios.h>
 #include <stdlib.h>
@@ -39,9 +43,11 @@
 #define DEFAULT_BULK_IN_DELAY		0x800
 
 #define RX_HEADER_SIZE			(4 + 4 + 2)
-#define TX_HEADER_SIZE			(4 + 4)
+#define TX_HEADER_SIZE			NET_FRAME_TX_HEADROOM
 
-#define MAX_RX_FRAME_SIZE		(2*6 + 2 + 1500 + 4)
+#define RX_FRAME_SIZE(mtu)		(2*6 + 2 + (mtu) + 4)
+#define MAX_RX_FRAME_SIZE		RX_FRAME_SIZE (1500)
+#define VLAN_TAG_SIZE			4
 
 // USB vendor requests
 #define WRITE_REGISTER			0xA0
@@ -100,6 +106,16 @@
 	#define PMT_CTL_WUPS_MLT		0x00000003
 	#define PMT_CTL_WUPS_MAC		0x00000002
 	#define PMT_CTL_WUPS_PHY		0x00000001
+#define DP_SEL				0x024
+	#define DP_SEL_DPRDY			0x80000000
+	#define DP_SEL_RSEL_MASK		0x0000000F
+	#define DP_SEL_RSEL_VLAN_DA		0x00000001
+	#define DP_SEL_VHF_HASH_LEN		16
+	#define DP_SEL_VHF_VLAN_LEN		128
+#define DP_CMD				0x028
+	#define DP_CMD_WRITE			0x00000001
+#define DP_ADDR				0x02C
+#define DP_DATA				0x030
 #define USB_CFG0			0x080
 	#define USB_CFG_BIR			0x00000040
 	#define USB_CFG_BCE			0x00000020
@@ -220,11 +236,24 @@
 	#define MAF_LO_ADDR_MASK		0xFFFFFFFF
 
 // TX command A
+#define TX_CMD_A_LSO			0x08000000
+#define TX_CMD_A_IPE			0x04000000
+#define TX_CMD_A_TPE			0x02000000
 #define TX_CMD_A_FCS			0x00400000
 #define TX_CMD_A_LEN_MASK		0x000FFFFF
 
+#define TX_CMD_B_MSS_SHIFT		16
+#define TX_CMD_B_MSS_MASK		0x3FFF0000
+#define TX_CMD_B_MSS_MIN		8
+
 // RX command A
+#define RX_CMD_A_ICE			0x80000000
+#define RX_CMD_A_TCE			0x40000000
+#define RX_CMD_A_PID_MASK		0x01800000
+	#define RX_CMD_A_PID_TCP		0x00800000
+	#define RX_CMD_A_PID_UDP		0x01000000
 #define RX_CMD_A_RED			0x00400000
+#define RX_CMD_A_ICSM			0x00004000
 #define RX_CMD_A_LEN_MASK		0x00003FFF
 
 boolean LAN7800DeviceInitMACAddress (TLAN7800Device *pThis);
@@ -244,6 +273,15 @@ static const char FromLAN7800[] = "lan7800";
 // starting at 10, to be sure to not collide with smsc951x driver
 static unsigned s_nDeviceNumber = 10;
 
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+static boolean LAN7800DeviceRxStatus (u32 nRxStatus, unsigned *pFrameLength)	// RX command A
+{
+	*pFrameLength = nRxStatus & RX_CMD_A_LEN_MASK;
+
+	return nRxStatus & RX_CMD_A_RED ? FALSE : TRUE;
+}
+#endif
+
 void LAN7800Device (TLAN7800Device *pThis, TUSBFunction *pFunction)
 {
 	UK_ASSERT (pThis != 0);
@@ -255,8 +293,31 @@ void LAN7800Device (TLAN7800Device *pThis, TUSBFunction *pFunction)
 	pThis->m_pEndpointBulkOut = 0;
 	pThis->m_pTxBuffer = 0;
 
-	pThis->m_pTxBuffer = malloc (FRAME_BUFFER_SIZE);
+	pThis->m_pTxBuffer = DMAPoolAllocate (LAN7800_FRAME_BUFFER_SIZE);
 	UK_ASSERT (pThis->m_pTxBuffer != 0);
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	void *pTxBatch = 0;
+	posix_memalign (&pTxBatch, DMA_POOL_ALIGN, TX_BATCH_SIZE);
+	pThis->m_pTxBatch = pTxBatch;
+	UK_ASSERT (pThis->m_pTxBatch != 0);
+	pThis->m_nTxBatchLength = 0;
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	NetRxBatch (&pThis->m_RxBatch, RX_HEADER_SIZE, LAN7800DeviceRxStatus);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	for (unsigned i = 0; i < RX_ASYNC_REQUESTS; i++)
+	{
+		pThis->m_RxRequest[i].m_bInUse = FALSE;
+	}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	NetTxQueue (&pThis->m_TxQueue);
+#endif
 }
 
 void _LAN7800Device (TLAN7800Device *pThis)
@@ -265,10 +326,19 @@ void _LAN7800Device (TLAN7800Device *pThis)
 
 	if (pThis->m_pTxBuffer != 0)
 	{
-		free (pThis->m_pTxBuffer);
+		DMAPoolFree (pThis->m_pTxBuffer);
 		pThis->m_pTxBuffer = 0;
 	}
 
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	free (pThis->m_pTxBatch);
+	pThis->m_pTxBatch = 0;
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	_NetRxBatch (&pThis->m_RxBatch);
+#endif
+
 	if (pThis->m_pEndpointBulkOut != 0)
 	{
 		_USBEndpoint (pThis->m_pEndpointBulkOut);
@@ -379,6 +449,20 @@ boolean LAN7800DeviceConfigure (TUSBFunction *pUSBFunction)
 		return FALSE;
 	}
 
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	// for USB high speed, a burst fills one aggregated transfer
+	if (   !LAN7800DeviceWriteReg (pThis, BURST_CAP, RX_AGGREGATE_SIZE / HS_USB_PKT_SIZE)
+	    || !LAN7800DeviceWriteReg (pThis, BULK_IN_DLY, DEFAULT_BULK_IN_DELAY))
+	{
+		return FALSE;
+	}
+
+	// enable the LEDs and MEF mode (several frames per bulk-IN transfer)
+	if (!LAN7800DeviceReadWriteReg (pThis, HW_CFG, HW_CFG_LED0_EN | HW_CFG_LED1_EN | HW_CFG_MEF, ~0U))
+	{
+		return FALSE;
+	}
+#else
 	// for USB high speed
 	if (   !LAN7800DeviceWriteReg (pThis, BURST_CAP, DEFAULT_BURST_CAP_SIZE / HS_USB_PKT_SIZE)
 	    || !LAN7800DeviceWriteReg (pThis, BULK_IN_DLY, DEFAULT_BULK_IN_DELAY))
@@ -391,12 +475,22 @@ boolean LAN7800DeviceConfigure (TUSBFunction *pUSBFunction)
 	{
 		return FALSE;
 	}
+#endif
 
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	// enable burst CAP, NAK on RX FIFO empty, so a posted bulk-IN request
+	// stays on the channel (which retries in hardware) until a frame arrives
+	if (!LAN7800DeviceReadWriteReg (pThis, USB_CFG0, USB_CFG_BCE | USB_CFG_BIR, ~0U))
+	{
+		return FALSE;
+	}
+#else
 	// enable burst CAP, disable NAK on RX FIFO empty
 	if (!LAN7800DeviceReadWriteReg (pThis, USB_CFG0, USB_CFG_BCE, ~USB_CFG_BIR))
 	{
 		return FALSE;
 	}
+#endif
 
 	// set FIFO sizes
 	if (   !LAN7800DeviceWriteReg (pThis, FCT_RX_FIFO_END, (MAX_RX_FIFO_SIZE - 512) / 512)
@@ -425,6 +519,14 @@ boolean LAN7800DeviceConfigure (TUSBFunction *pUSBFunction)
 		return FALSE;
 	}
 
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+	// verify the IP and TCP/UDP checksums of received frames
+	if (!LAN7800DeviceReadWriteReg (pThis, RFE_CTL, RFE_CTL_TCPUDP_COE | RFE_CTL_IP_COE, ~0U))
+	{
+		return FALSE;
+	}
+#endif
+
 	// PHY reset
 	if (   !LAN7800DeviceReadWriteReg (pThis, PMT_CTL, PMT_CTL_PHY_RST, ~0U)
 	    || !LAN7800DeviceWaitReg (pThis, PMT_CTL, PMT_CTL_PHY_RST | PMT_CTL_READY, PMT_CTL_READY))
@@ -464,6 +566,15 @@ boolean LAN7800DeviceConfigure (TUSBFunction *pUSBFunction)
 		return FALSE;
 	}
 
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	// every frame goes through these, so keep their channels set up
+	if (   !DWHCIDeviceBindChannel (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkIn)
+	    || !DWHCIDeviceBindChannel (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut))
+	{
+		LogWrite (LOG_ERROR, "Cannot bind channels, using shared ones");
+	}
+#endif
+
 	TString DeviceName;
 	String (&DeviceName);
 	StringFormat (&DeviceName, "eth%u", s_nDeviceNumber++);
@@ -485,14 +596,14 @@ boolean LAN7800DeviceSendFrame (TLAN7800Device *pThis, const void *pBuffer, unsi
 {
 	UK_ASSERT (pThis != 0);
 
-	if (nLength > FRAME_BUFFER_SIZE-TX_HEADER_SIZE)
+	if (!NetFrameTxFits (nLength, LAN7800_FRAME_BUFFER_SIZE))
 	{
 		return FALSE;
 	}
 
 	UK_ASSERT (pThis->m_pTxBuffer != 0);
 	UK_ASSERT (pBuffer != 0);
-	memcpy (pThis->m_pTxBuffer+TX_HEADER_SIZE, pBuffer, nLength);
+	raspi_memcpy (pThis->m_pTxBuffer+TX_HEADER_SIZE, pBuffer, nLength);
 
 	*(u32 *) &pThis->m_pTxBuffer[0] = (nLength & TX_CMD_A_LEN_MASK) | TX_CMD_A_FCS;
 	*(u32 *) &pThis->m_pTxBuffer[4] = 0;
@@ -502,62 +613,320 @@ boolean LAN7800DeviceSendFrame (TLAN7800Device *pThis, const void *pBuffer, unsi
 				    pThis->m_pTxBuffer, nLength+TX_HEADER_SIZE) >= 0;
 }
 
-boolean LAN7800DeviceReceiveFrame (TLAN7800Device *pThis, void *pBuffer, unsigned *pResultLength)
+// writes the TX command words in front of pFrame, returns where the transfer starts
+static u8 *LAN7800DeviceWriteTxHeader (void *pFrame, unsigned nLength, unsigned nFlags)
+{
+	UK_ASSERT (pFrame != 0);
+	u8 *pBuffer = (u8 *) pFrame - TX_HEADER_SIZE;
+	UK_ASSERT (((uintptr) pBuffer & 3) == 0);
+
+	u32 nTxCmdA = (nLength & TX_CMD_A_LEN_MASK) | TX_CMD_A_FCS;
+	u32 nTxCmdB = 0;
+	if (nFlags & LAN7800_TX_CSUM)
+	{
+		nTxCmdA |= TX_CMD_A_IPE | TX_CMD_A_TPE;
+	}
+
+	if (nFlags & LAN7800_TX_LSO)
+	{
+		// segmented frames always get their checksums inserted
+		nTxCmdA |= TX_CMD_A_LSO | TX_CMD_A_IPE | TX_CMD_A_TPE;
+
+		unsigned nMSS = (nFlags & TX_CMD_B_MSS_MASK) >> TX_CMD_B_MSS_SHIFT;
+		if (nMSS < TX_CMD_B_MSS_MIN)
+		{
+			nMSS = TX_CMD_B_MSS_MIN;
+		}
+
+		nTxCmdB = (nMSS << TX_CMD_B_MSS_SHIFT) & TX_CMD_B_MSS_MASK;
+	}
+
+	*(u32 *) &pBuffer[0] = nTxCmdA;
+	*(u32 *) &pBuffer[4] = nTxCmdB;
+
+	return pBuffer;
+}
+
+// a frame the device segments may be longer than a single one
+static unsigned LAN7800DeviceTxMaxLength (unsigned nFlags)
+{
+	return (nFlags & LAN7800_TX_LSO) ? LAN7800_TX_LSO_MAX_SIZE : LAN7800_FRAME_BUFFER_SIZE-TX_HEADER_SIZE;
+}
+
+boolean LAN7800DeviceSendFrameInPlace (TLAN7800Device *pThis, void *pFrame, unsigned nLength,
+				       unsigned nFlags)
 {
 	UK_ASSERT (pThis != 0);
 
-	UK_ASSERT (pThis->m_pEndpointBulkIn != 0);
-	UK_ASSERT (pBuffer != 0);
-	TUSBRequest URB;
-	USBRequest (&URB, pThis->m_pEndpointBulkIn, pBuffer, FRAME_BUFFER_SIZE, 0);
+	if (nLength > LAN7800DeviceTxMaxLength (nFlags))
+	{
+		return FALSE;
+	}
 
-	if (!DWHCIDeviceSubmitBlockingRequest (USBFunctionGetHost (&pThis->m_USBFunction), &URB))
+	u8 *pBuffer = LAN7800DeviceWriteTxHeader (pFrame, nLength, nFlags);
+
+	UK_ASSERT (pThis->m_pEndpointBulkOut != 0);
+	return DWHCIDeviceTransfer (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut,
+				    pBuffer, nLength+TX_HEADER_SIZE) >= 0;
+}
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+boolean LAN7800DeviceSendFrameAsync (TLAN7800Device *pThis, void *pFrame, unsigned nLength,
+				   unsigned nFlags, TNetFrameSentHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pHandler != 0);
+
+	if (nLength > LAN7800DeviceTxMaxLength (nFlags))
 	{
-		_USBRequest (&URB);
+		return FALSE;
+	}
+
+	u8 *pBuffer = LAN7800DeviceWriteTxHeader (pFrame, nLength, nFlags);
+
+	return NetTxQueueSend (&pThis->m_TxQueue, USBFunctionGetHost (&pThis->m_USBFunction),
+			       pThis->m_pEndpointBulkOut, pBuffer, nLength+TX_HEADER_SIZE, pHandler, pParam);
+}
+#endif
 
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+boolean LAN7800DeviceQueueFrame (TLAN7800Device *pThis, const void *pBuffer, unsigned nLength,
+				 unsigned nFlags)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (!(nFlags & LAN7800_TX_LSO));
+
+	if (!NetFrameTxFits (nLength, LAN7800_FRAME_BUFFER_SIZE))
+	{
 		return FALSE;
 	}
 
-	u32 nResultLength = USBRequestGetResultLength (&URB);
-	if (nResultLength < RX_HEADER_SIZE)
+	// each frame starts on a 4 byte boundary
+	UK_ASSERT (pThis->m_pTxBatch != 0);
+	unsigned nOffset = (pThis->m_nTxBatchLength + 3) & ~3;
+	u8 *pHeader = pThis->m_pTxBatch + nOffset;
+
+	UK_ASSERT (pBuffer != 0);
+	raspi_memcpy (pHeader+TX_HEADER_SIZE, pBuffer, nLength);
+
+	LAN7800DeviceWriteTxHeader (pHeader+TX_HEADER_SIZE, nLength, nFlags);
+
+	pThis->m_nTxBatchLength = nOffset + TX_HEADER_SIZE + nLength;
+
+	// flush while the next frame is sure to fit, so queueing never has to
+	if (((pThis->m_nTxBatchLength + 3) & ~3) + LAN7800_FRAME_BUFFER_SIZE > TX_BATCH_SIZE)
 	{
-		_USBRequest (&URB);
+		return LAN7800DeviceFlushFrames (pThis);
+	}
 
+	return TRUE;
+}
+
+boolean LAN7800DeviceFlushFrames (TLAN7800Device *pThis)
+{
+	UK_ASSERT (pThis != 0);
+
+	unsigned nLength = pThis->m_nTxBatchLength;
+	if (nLength == 0)
+	{
+		return TRUE;
+	}
+	pThis->m_nTxBatchLength = 0;
+
+	UK_ASSERT (pThis->m_pEndpointBulkOut != 0);
+	return DWHCIDeviceTransfer (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut,
+				    pThis->m_pTxBatch, nLength) >= 0;
+}
+#endif
+
+boolean LAN7800DeviceReceiveFrame (TLAN7800Device *pThis, void *pBuffer, unsigned *pResultLength)
+{
+	unsigned nFrameOffset;
+	if (!LAN7800DeviceReceiveFrameInPlace (pThis, pBuffer, LAN7800_FRAME_BUFFER_SIZE,
+					       pResultLength, &nFrameOffset))
+	{
 		return FALSE;
 	}
 
-	u32 nRxStatus = *(u32 *) pBuffer;	// RX command A
+	memmove (pBuffer, (u8 *) pBuffer + nFrameOffset, *pResultLength); // overwrite RX command A..C
+
+	return TRUE;
+}
+
+// returns the length of the frame (without FCS) received into pBuffer, 0 if there is none
+static unsigned LAN7800DeviceGetFrameLength (const void *pBuffer, u32 nResultLength)
+{
+	if (nResultLength < RX_HEADER_SIZE)
+	{
+		return 0;
+	}
+
+	u32 nRxStatus = *(const u32 *) pBuffer;	// RX command A
 	if (nRxStatus & RX_CMD_A_RED)
 	{
 		LogWrite (LOG_WARNING, "RX error (status 0x%X)", nRxStatus);
 
-		_USBRequest (&URB);
-
-		return FALSE;
+		return 0;
 	}
 
 	u32 nFrameLength = nRxStatus & RX_CMD_A_LEN_MASK;
 	UK_ASSERT (nFrameLength == nResultLength-RX_HEADER_SIZE);
 	UK_ASSERT (nFrameLength > 4);
 	if (nFrameLength <= 4)
+	{
+		return 0;
+	}
+
+	//LogWrite (LOG_DEBUG, "Frame received (status 0x%X)", nRxStatus);
+
+	return nFrameLength - 4;	// ignore FCS
+}
+
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+boolean LAN7800DeviceFrameChecksumValid (TLAN7800Device *pThis, const void *pFrame)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pFrame != 0);
+
+	u32 nRxStatus = *(const u32 *) ((const u8 *) pFrame - RX_HEADER_SIZE);	// RX command A
+
+	// only TCP and UDP frames have both checksums checked
+	u32 nProtocol = nRxStatus & RX_CMD_A_PID_MASK;
+	if (   nProtocol != RX_CMD_A_PID_TCP
+	    && nProtocol != RX_CMD_A_PID_UDP)
+	{
+		return FALSE;
+	}
+
+	return (nRxStatus & (RX_CMD_A_ICE | RX_CMD_A_TCE | RX_CMD_A_ICSM)) ? FALSE : TRUE;
+}
+#endif
+
+boolean LAN7800DeviceReceiveFrameInPlace (TLAN7800Device *pThis, void *pBuffer, unsigned nBufSize,
+					  unsigned *pResultLength, unsigned *pFrameOffset)
+{
+	UK_ASSERT (pThis != 0);
+
+	UK_ASSERT (pThis->m_pEndpointBulkIn != 0);
+	UK_ASSERT (pBuffer != 0);
+	UK_ASSERT (nBufSize <= LAN7800_FRAME_BUFFER_SIZE);
+	TUSBRequest URB;
+	USBRequest (&URB, pThis->m_pEndpointBulkIn, pBuffer, nBufSize, 0);
+
+	if (!DWHCIDeviceSubmitBlockingRequest (USBFunctionGetHost (&pThis->m_USBFunction), &URB))
 	{
 		_USBRequest (&URB);
 
 		return FALSE;
 	}
-	nFrameLength -= 4;	// ignore FCS
 
-	//LogWrite (LOG_DEBUG, "Frame received (status 0x%X)", nRxStatus);
+	unsigned nFrameLength = LAN7800DeviceGetFrameLength (pBuffer, USBRequestGetResultLength (&URB));
 
-	memcpy (pBuffer, (u8 *) pBuffer + RX_HEADER_SIZE, nFrameLength); // overwrite RX command A..C
+	_USBRequest (&URB);
+
+	if (nFrameLength == 0)
+	{
+		return FALSE;
+	}
 
 	UK_ASSERT (pResultLength != 0);
 	*pResultLength = nFrameLength;
+	UK_ASSERT (pFrameOffset != 0);
+	*pFrameOffset = RX_HEADER_SIZE;
 
-	_USBRequest (&URB);
+	return TRUE;
+}
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+static void LAN7800DeviceRxCompletionRoutine (TUSBRequest *pURB, void *pParam, void *pContext)
+{
+	TLAN7800Device *pThis = (TLAN7800Device *) pContext;
+	UK_ASSERT (pThis != 0);
+	TLAN7800RxRequest *pRequest = (TLAN7800RxRequest *) pParam;
+	UK_ASSERT (pRequest != 0);
+	UK_ASSERT (pURB == &pRequest->m_URB);
+
+	void *pBuffer = USBRequestGetBuffer (pURB);
+	unsigned nFrameLength = 0;
+
+	if (USBRequestGetStatus (pURB))
+	{
+		nFrameLength = LAN7800DeviceGetFrameLength (pBuffer, USBRequestGetResultLength (pURB));
+		if (   nFrameLength == 0
+		    && DWHCIDeviceSubmitAsyncRequest (USBFunctionGetHost (&pThis->m_USBFunction), pURB))
+		{
+			return;
+		}
+	}
+
+	TLAN7800FrameHandler *pHandler = pRequest->m_pHandler;
+	void *pHandlerParam = pRequest->m_pParam;
+
+	_USBRequest (pURB);
+	pRequest->m_bInUse = FALSE;
+
+	(*pHandler) (pBuffer, nFrameLength, RX_HEADER_SIZE, pHandlerParam);
+}
+
+boolean LAN7800DeviceReceiveFrameAsync (TLAN7800Device *pThis, void *pBuffer, unsigned nBufSize,
+					TLAN7800FrameHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (pThis != 0);
+
+	UK_ASSERT (pThis->m_pEndpointBulkIn != 0);
+	UK_ASSERT (pBuffer != 0);
+	UK_ASSERT (((uintptr) pBuffer & (DMA_POOL_ALIGN-1)) == 0);
+	UK_ASSERT (nBufSize <= LAN7800_FRAME_BUFFER_SIZE);
+	UK_ASSERT (pHandler != 0);
+
+	TLAN7800RxRequest *pRequest = 0;
+
+	uspi_EnterCritical ();
+	for (unsigned i = 0; i < RX_ASYNC_REQUESTS; i++)
+	{
+		if (!pThis->m_RxRequest[i].m_bInUse)
+		{
+			pRequest = &pThis->m_RxRequest[i];
+			pRequest->m_bInUse = TRUE;
+
+			break;
+		}
+	}
+	uspi_LeaveCritical ();
+
+	if (pRequest == 0)
+	{
+		return FALSE;
+	}
+
+	pRequest->m_pHandler = pHandler;
+	pRequest->m_pParam = pParam;
+
+	USBRequest (&pRequest->m_URB, pThis->m_pEndpointBulkIn, pBuffer, nBufSize, 0);
+	USBRequestSetCompletionRoutine (&pRequest->m_URB, LAN7800DeviceRxCompletionRoutine, pRequest, pThis);
+
+	if (!DWHCIDeviceSubmitAsyncRequest (USBFunctionGetHost (&pThis->m_USBFunction), &pRequest->m_URB))
+	{
+		_USBRequest (&pRequest->m_URB);
+		pRequest->m_bInUse = FALSE;
+
+		return FALSE;
+	}
 
 	return TRUE;
 }
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+boolean LAN7800DeviceReceiveFrameAggregated (TLAN7800Device *pThis, const void **ppFrame,
+					  unsigned *pResultLength)
+{
+	UK_ASSERT (pThis != 0);
+
+	return NetRxBatchGetFrame (&pThis->m_RxBatch, USBFunctionGetHost (&pThis->m_USBFunction),
+				   pThis->m_pEndpointBulkIn, ppFrame, pResultLength);
+}
+#endif
 
 boolean LAN7800DeviceIsLinkUp (TLAN7800Device *pThis)
 {
@@ -572,6 +941,154 @@ boolean LAN7800DeviceIsLinkUp (TLAN7800Device *pThis)
 	return usPHYModeStatus & (1 << 2) ? TRUE : FALSE;
 }
 
+// writes nLength words to the internal RAM nRAMSelect, starting at word nAddress
+static boolean LAN7800DeviceDataPortWrite (TLAN7800Device *pThis, u32 nRAMSelect, u32 nAddress,
+					   const u32 *pData, unsigned nLength)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pData != 0);
+
+	if (   !LAN7800DeviceWaitReg (pThis, DP_SEL, DP_SEL_DPRDY, DP_SEL_DPRDY)
+	    || !LAN7800DeviceReadWriteReg (pThis, DP_SEL, nRAMSelect, ~DP_SEL_RSEL_MASK))
+	{
+		return FALSE;
+	}
+
+	for (unsigned i = 0; i < nLength; i++)
+	{
+		if (   !LAN7800DeviceWriteReg (pThis, DP_ADDR, nAddress + i)
+		    || !LAN7800DeviceWriteReg (pThis, DP_DATA, pData[i])
+		    || !LAN7800DeviceWriteReg (pThis, DP_CMD, DP_CMD_WRITE)
+		    || !LAN7800DeviceWaitReg (pThis, DP_SEL, DP_SEL_DPRDY, DP_SEL_DPRDY))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+boolean LAN7800DeviceSetRxFilter (TLAN7800Device *pThis, boolean bPromisc, boolean bAllMulticast,
+				  const u8 *pMulticast, unsigned nCount)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pMulticast != 0 || nCount == 0);
+
+	u32 nRFECtl = 0;
+	if (bPromisc)
+	{
+		nRFECtl |= RFE_CTL_UCAST_EN | RFE_CTL_MCAST_EN;
+	}
+	else if (bAllMulticast)
+	{
+		nRFECtl |= RFE_CTL_MCAST_EN;
+	}
+
+	// perfect filter entry 0 holds our own address, the addresses which
+	// do not fit into the other entries go to the hash filter
+	for (unsigned nEntry = 1; nEntry < NUM_OF_MAF; nEntry++)
+	{
+		u32 nAddressLow = 0;
+		u32 nAddressHigh = 0;
+		if (nEntry <= nCount)
+		{
+			const u8 *pAddress = pMulticast + (nEntry-1) * MAC_ADDRESS_SIZE;
+
+			nAddressLow =    (u32) pAddress[0]
+				      | ((u32) pAddress[1] << 8)
+				      | ((u32) pAddress[2] << 16)
+				      | ((u32) pAddress[3] << 24);
+			nAddressHigh =    (u32) pAddress[4]
+				       | ((u32) pAddress[5] << 8)
+				       | MAF_HI_VALID | MAF_HI_TYPE_DST;
+		}
+
+		if (   !LAN7800DeviceWriteReg (pThis, MAF_HI (nEntry), 0)
+		    || !LAN7800DeviceWriteReg (pThis, MAF_LO (nEntry), nAddressLow)
+		    || !LAN7800DeviceWriteReg (pThis, MAF_HI (nEntry), nAddressHigh))
+		{
+			return FALSE;
+		}
+	}
+
+	u32 HashTable[DP_SEL_VHF_HASH_LEN];
+	memset (HashTable, 0, sizeof HashTable);
+
+	for (unsigned i = NUM_OF_MAF-1; i < nCount; i++)
+	{
+		TMACAddress Address;
+		MACAddress2 (&Address, pMulticast + i * MAC_ADDRESS_SIZE);
+
+		unsigned nBit = (MACAddressGetCRC (&Address) >> 23) & 0x1FF;
+		HashTable[nBit / 32] |= 1U << (nBit % 32);
+		nRFECtl |= RFE_CTL_MCAST_HASH;
+
+		_MACAddress (&Address);
+	}
+
+	// the hash table follows the VLAN table in the VLAN/DA RAM
+	if (   !LAN7800DeviceDataPortWrite (pThis, DP_SEL_RSEL_VLAN_DA, DP_SEL_VHF_VLAN_LEN,
+					    HashTable, DP_SEL_VHF_HASH_LEN)
+	    || !LAN7800DeviceReadWriteReg (pThis, RFE_CTL, nRFECtl,
+					   ~(RFE_CTL_UCAST_EN | RFE_CTL_MCAST_EN | RFE_CTL_MCAST_HASH)))
+	{
+		LogWrite (LOG_ERROR, "Cannot set receive filter");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean LAN7800DeviceSetMTU (TLAN7800Device *pThis, unsigned nMTU)
+{
+	UK_ASSERT (pThis != 0);
+
+	if (nMTU > LAN7800_MAX_MTU)
+	{
+		return FALSE;
+	}
+
+	u32 nMACRx;
+	if (!LAN7800DeviceReadReg (pThis, MAC_RX, &nMACRx))
+	{
+		return FALSE;
+	}
+
+	// the receiver is stopped while the maximum frame size changes
+	if (   (nMACRx & MAC_RX_RXEN)
+	    && !LAN7800DeviceWriteReg (pThis, MAC_RX, nMACRx & ~MAC_RX_RXEN))
+	{
+		return FALSE;
+	}
+
+	u32 nValue =   (nMACRx & ~(MAC_RX_MAX_SIZE_MASK | MAC_RX_RXEN))
+		     | ((RX_FRAME_SIZE (nMTU) << MAC_RX_MAX_SIZE_SHIFT) & MAC_RX_MAX_SIZE_MASK);
+	if (   !LAN7800DeviceWriteReg (pThis, MAC_RX, nValue)
+	    || (   (nMACRx & MAC_RX_RXEN)
+		&& !LAN7800DeviceWriteReg (pThis, MAC_RX, nValue | MAC_RX_RXEN)))
+	{
+		LogWrite (LOG_ERROR, "Cannot set MTU %u", nMTU);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+unsigned LAN7800DeviceGetRxBufferSize (TLAN7800Device *pThis, unsigned nMTU)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (nMTU <= LAN7800_MAX_MTU);
+
+	// a buffer that ends in a partial packet would make a full one babble
+	unsigned nSize = RX_HEADER_SIZE + RX_FRAME_SIZE (nMTU) + VLAN_TAG_SIZE;
+	nSize = (nSize + HS_USB_PKT_SIZE-1) & ~(HS_USB_PKT_SIZE-1);
+	UK_ASSERT (nSize <= LAN7800_FRAME_BUFFER_SIZE);
+
+	return nSize;
+}
+
 boolean LAN7800DeviceInitMACAddress (TLAN7800Device *pThis)
 {
 	UK_ASSERT (pThis != 0);
@@ -100,6 +100,24 @@ boolean MACAddressIsBroadcast (TMACAddress *pThis)
 	return TRUE;
 }
 
+u32 MACAddressGetCRC (TMACAddress *pThis)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pThis->m_bValid);
+
+	u32 nCRC = 0xFFFFFFFF;
+	for (unsigned i = 0; i < MAC_ADDRESS_SIZE; i++)
+	{
+		u8 uchOctet = pThis->m_Address[i];
+		for (unsigned nBit = 0; nBit < 8; nBit++, uchOctet >>= 1)
+		{
+			nCRC = (nCRC << 1) ^ ((((nCRC >> 31) ^ uchOctet) & 1) ? 0x04C11DB7 : 0);
+		}
+	}
+
+	return nCRC;
+}
+
 unsigned MACAddressGetSize (TMACAddress *pThis)
 {
 	return MAC_ADDRESS_SIZE;
@@ -1,30 +0,0 @@
-//
-// memio.cpp
-//
-// USPi - An USB driver for Raspberry Pi written in C
-// Copyright (C) 2014-2018  R. Stange <rsta2@o2online.de>
-// 
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program.  If not, see <http://www.gnu.org/licenses/>.
-//
-#include <uspienv/memio.h>
-
-u32 read32 (u32 nAddress)
-{
-	return *(volatile u32 *) nAddress;
-}
-
-void write32 (u32 nAddress, u32 nValue)
-{
-	*(volatile u32 *) nAddress = nValue;
-}
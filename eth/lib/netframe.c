@@ -0,0 +1,196 @@
+//
+// netframe.c
+//
+// USPi - An USB driver for Raspberry Pi written in C
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <uspi/netframe.h>
+#include <uspi/usbrequest.h>
+#include <uspi/dmapool.h>
+#include <uspi/synchronize.h>
+#include <uspios.h>
+#include <uk/assert.h>
+#include <stdlib.h>
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+void NetRxBatch (TNetRxBatch *pThis, unsigned nHeaderSize, TNetRxBatchStatusRoutine *pStatusRoutine)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (nHeaderSize >= 4);
+	UK_ASSERT (pStatusRoutine != 0);
+
+	// Too large for the DMA pool, and the frames are copied out of it, so
+	// it is cacheable. Cache line alignment keeps invalidation to itself.
+	void *pBuffer = 0;
+	posix_memalign (&pBuffer, DMA_POOL_ALIGN, RX_AGGREGATE_SIZE);
+	pThis->m_pBuffer = pBuffer;
+	UK_ASSERT (pThis->m_pBuffer != 0);
+	pThis->m_nLength = 0;
+	pThis->m_nOffset = 0;
+	pThis->m_nHeaderSize = nHeaderSize;
+	pThis->m_pStatusRoutine = pStatusRoutine;
+}
+
+void _NetRxBatch (TNetRxBatch *pThis)
+{
+	UK_ASSERT (pThis != 0);
+
+	free (pThis->m_pBuffer);
+	pThis->m_pBuffer = 0;
+}
+
+boolean NetRxBatchGetFrame (TNetRxBatch *pThis, TDWHCIDevice *pHost, TUSBEndpoint *pEndpoint,
+			    const void **ppFrame, unsigned *pResultLength)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pThis->m_pBuffer != 0);
+
+	unsigned nHeaderSize = pThis->m_nHeaderSize;
+
+	while (1)
+	{
+		if (pThis->m_nOffset + nHeaderSize > pThis->m_nLength)
+		{
+			// all frames of the last transfer returned, fetch the next batch
+			pThis->m_nOffset = 0;
+			pThis->m_nLength = 0;
+
+			UK_ASSERT (pEndpoint != 0);
+			TUSBRequest URB;
+			USBRequest (&URB, pEndpoint, pThis->m_pBuffer, RX_AGGREGATE_SIZE, 0);
+
+			if (!DWHCIDeviceSubmitBlockingRequest (pHost, &URB))
+			{
+				_USBRequest (&URB);
+
+				return FALSE;
+			}
+
+			pThis->m_nLength = USBRequestGetResultLength (&URB);
+
+			_USBRequest (&URB);
+
+			if (pThis->m_nLength < nHeaderSize)
+			{
+				return FALSE;
+			}
+		}
+
+		u8 *pHeader = pThis->m_pBuffer + pThis->m_nOffset;
+		u32 nRxStatus = *(u32 *) pHeader;
+		unsigned nFrameLength;
+		boolean bOK = (*pThis->m_pStatusRoutine) (nRxStatus, &nFrameLength);
+
+		if (   nFrameLength <= 4
+		    || pThis->m_nOffset + nHeaderSize + nFrameLength > pThis->m_nLength)
+		{
+			LogWrite (LOG_WARNING, "Malformed RX batch (status 0x%X)", nRxStatus);
+
+			pThis->m_nOffset = pThis->m_nLength;	// drop the rest
+
+			return FALSE;
+		}
+
+		// the next header starts on a 4 byte boundary
+		pThis->m_nOffset = (pThis->m_nOffset + nHeaderSize + nFrameLength + 3) & ~3;
+
+		if (!bOK)
+		{
+			LogWrite (LOG_WARNING, "RX error (status 0x%X)", nRxStatus);
+
+			continue;
+		}
+
+		UK_ASSERT (ppFrame != 0);
+		*ppFrame = pHeader + nHeaderSize;
+		UK_ASSERT (pResultLength != 0);
+		*pResultLength = nFrameLength - 4;	// ignore FCS
+
+		return TRUE;
+	}
+}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+void NetTxQueue (TNetTxQueue *pThis)
+{
+	UK_ASSERT (pThis != 0);
+
+	for (unsigned i = 0; i < TX_ASYNC_REQUESTS; i++)
+	{
+		pThis->m_Request[i].m_bInUse = FALSE;
+	}
+}
+
+static void NetTxQueueCompletionRoutine (TUSBRequest *pURB, void *pParam, void *pContext)
+{
+	TNetTxRequest *pRequest = (TNetTxRequest *) pParam;
+	UK_ASSERT (pRequest != 0);
+	UK_ASSERT (pURB == &pRequest->m_URB);
+
+	boolean bOK = USBRequestGetStatus (pURB) ? TRUE : FALSE;
+	TNetFrameSentHandler *pHandler = pRequest->m_pHandler;
+	void *pHandlerParam = pRequest->m_pParam;
+
+	_USBRequest (pURB);
+	pRequest->m_bInUse = FALSE;
+
+	(*pHandler) (bOK, pHandlerParam);
+}
+
+boolean NetTxQueueSend (TNetTxQueue *pThis, TDWHCIDevice *pHost, TUSBEndpoint *pEndpoint,
+			void *pBuffer, unsigned nLength, TNetFrameSentHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pEndpoint != 0);
+	UK_ASSERT (pHandler != 0);
+
+	TNetTxRequest *pRequest = 0;
+
+	uspi_EnterCritical ();
+	for (unsigned i = 0; i < TX_ASYNC_REQUESTS; i++)
+	{
+		if (!pThis->m_Request[i].m_bInUse)
+		{
+			pRequest = &pThis->m_Request[i];
+			pRequest->m_bInUse = TRUE;
+
+			break;
+		}
+	}
+	uspi_LeaveCritical ();
+
+	if (pRequest == 0)
+	{
+		return FALSE;
+	}
+
+	pRequest->m_pHandler = pHandler;
+	pRequest->m_pParam = pParam;
+
+	USBRequest (&pRequest->m_URB, pEndpoint, pBuffer, nLength, 0);
+	USBRequestSetCompletionRoutine (&pRequest->m_URB, NetTxQueueCompletionRoutine, pRequest, pThis);
+
+	if (!DWHCIDeviceSubmitAsyncRequest (pHost, &pRequest->m_URB))
+	{
+		_USBRequest (&pRequest->m_URB);
+		pRequest->m_bInUse = FALSE;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif
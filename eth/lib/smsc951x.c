@@ -25,10 +25,14 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <uspi/smsc951x.h>
+#include <uspi/netframe.h>
 #include <uspios.h>
 #include <uspi/usbhostcontroller.h>
 #include <uspi/devicenameservice.h>
 #include <uspi/util.h>
+#include <uspi/dmapool.h>
+#include <uspi/synchronize.h>
+#include <raspi/string.h>
 #include <uk/assert.h>
 #include <uspios.h>
 #include <stdlib.h>
@@ -45,6 +49,7 @@
 	#define TX_CFG_ON			0x00000004
 #define HW_CFG				0x14
 	#define HW_CFG_BIR			0x00001000
+	#define HW_CFG_MEF			0x00000020
 #define RX_FIFO_INF			0x18
 #define PM_CTRL				0x20
 #define LED_GPIO_CFG			0x24
@@ -59,10 +64,12 @@
 #define GPIO_WAKE			0x64
 #define INT_EP_CTL			0x68
 #define BULK_IN_DLY			0x6C
+	#define DEFAULT_BULK_IN_DELAY		0x2000
 #define MAC_CR				0x100
 	#define MAC_CR_RCVOWN			0x00800000
 	#define MAC_CR_MCPAS			0x00080000
 	#define MAC_CR_PRMS			0x00040000
+	#define MAC_CR_HPFILT			0x00002000
 	#define MAC_CR_BCAST			0x00000800
 	#define MAC_CR_TXEN			0x00000008
 	#define MAC_CR_RXEN			0x00000004
@@ -133,6 +140,15 @@ void SMSC951xDeviceDumpReg (TSMSC951xDevice *pThis, const char *pName, u32 nInde
 void SMSC951xDeviceDumpRegs (TSMSC951xDevice *pThis);
 #endif
 
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+static boolean SMSC951xDeviceRxStatus (u32 nRxStatus, unsigned *pFrameLength)
+{
+	*pFrameLength = RX_STS_FRAMELEN (nRxStatus);
+
+	return nRxStatus & RX_STS_ERROR ? FALSE : TRUE;
+}
+#endif
+
 void SMSC951xDevice (TSMSC951xDevice *pThis, TUSBFunction *pDevice)
 {
 	UK_ASSERT (pThis != 0);
@@ -144,8 +160,31 @@ void SMSC951xDevice (TSMSC951xDevice *pThis, TUSBFunction *pDevice)
 	pThis->m_pEndpointBulkOut = 0;
 	pThis->m_pTxBuffer = 0;
 
-	pThis->m_pTxBuffer = malloc (FRAME_BUFFER_SIZE);
+	pThis->m_pTxBuffer = DMAPoolAllocate (FRAME_BUFFER_SIZE);
 	UK_ASSERT (pThis->m_pTxBuffer != 0);
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	void *pTxBatch = 0;
+	posix_memalign (&pTxBatch, DMA_POOL_ALIGN, TX_BATCH_SIZE);
+	pThis->m_pTxBatch = pTxBatch;
+	UK_ASSERT (pThis->m_pTxBatch != 0);
+	pThis->m_nTxBatchLength = 0;
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	NetRxBatch (&pThis->m_RxBatch, 4, SMSC951xDeviceRxStatus);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	for (unsigned i = 0; i < RX_ASYNC_REQUESTS; i++)
+	{
+		pThis->m_RxRequest[i].m_bInUse = FALSE;
+	}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	NetTxQueue (&pThis->m_TxQueue);
+#endif
 }
 
 void _SMSC951xDevice (TSMSC951xDevice *pThis)
@@ -154,9 +193,18 @@ void _SMSC951xDevice (TSMSC951xDevice *pThis)
 
 	if (pThis->m_pTxBuffer != 0)
 	{
-		free (pThis->m_pTxBuffer);
+		DMAPoolFree (pThis->m_pTxBuffer);
 		pThis->m_pTxBuffer = 0;
 	}
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	free (pThis->m_pTxBatch);
+	pThis->m_pTxBatch = 0;
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	_NetRxBatch (&pThis->m_RxBatch);
+#endif
 	
 	if (pThis->m_pEndpointBulkOut != 0)
 	{
@@ -280,6 +328,37 @@ boolean SMSC951xDeviceConfigure (TUSBFunction *pUSBFunction)
 		return FALSE;
 	}
 
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	// let the device pack several frames into one bulk-IN transfer
+	u32 nHWConfig;
+	if (   !SMSC951xDeviceWriteReg (pThis, BURST_CAP, RX_AGGREGATE_SIZE / 512)	// high speed packets
+	    || !SMSC951xDeviceWriteReg (pThis, BULK_IN_DLY, DEFAULT_BULK_IN_DELAY)
+	    || !SMSC951xDeviceReadReg (pThis, HW_CFG, &nHWConfig)
+	    || !SMSC951xDeviceWriteReg (pThis, HW_CFG, nHWConfig | HW_CFG_MEF | HW_CFG_BIR))
+	{
+		LogWrite (LOG_ERROR, "Cannot enable RX aggregation");
+
+		_String (&MACString);
+
+		return FALSE;
+	}
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	// NAK bulk-IN tokens while there is no frame, so a posted request stays
+	// on the channel (which retries in hardware) instead of completing empty
+	u32 nHWConfig;
+	if (   !SMSC951xDeviceReadReg (pThis, HW_CFG, &nHWConfig)
+	    || !SMSC951xDeviceWriteReg (pThis, HW_CFG, nHWConfig | HW_CFG_BIR))
+	{
+		LogWrite (LOG_ERROR, "Cannot set bulk-in empty response");
+
+		_String (&MACString);
+
+		return FALSE;
+	}
+#endif
+
 	if (   !SMSC951xDeviceWriteReg (pThis, LED_GPIO_CFG,   LED_GPIO_CFG_SPD_LED
 							     | LED_GPIO_CFG_LNK_LED
 							     | LED_GPIO_CFG_FDX_LED)
@@ -296,6 +375,15 @@ boolean SMSC951xDeviceConfigure (TUSBFunction *pUSBFunction)
 		return FALSE;
 	}
 
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	// every frame goes through these, so keep their channels set up
+	if (   !DWHCIDeviceBindChannel (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkIn)
+	    || !DWHCIDeviceBindChannel (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut))
+	{
+		LogWrite (LOG_ERROR, "Cannot bind channels, using shared ones");
+	}
+#endif
+
 	TString DeviceName;
 	String (&DeviceName);
 	StringFormat (&DeviceName, "eth%u", s_nDeviceNumber++);
@@ -318,14 +406,14 @@ boolean SMSC951xDeviceSendFrame (TSMSC951xDevice *pThis, const void *pBuffer, un
 {
 	UK_ASSERT (pThis != 0);
 
-	if (nLength >= FRAME_BUFFER_SIZE-8)
+	if (!NetFrameTxFits (nLength, FRAME_BUFFER_SIZE))
 	{
 		return FALSE;
 	}
 
 	UK_ASSERT (pThis->m_pTxBuffer != 0);
 	UK_ASSERT (pBuffer != 0);
-	memcpy (pThis->m_pTxBuffer+8, pBuffer, nLength);
+	raspi_memcpy (pThis->m_pTxBuffer+8, pBuffer, nLength);
 	
 	*(u32 *) &pThis->m_pTxBuffer[0] = TX_CMD_A_FIRST_SEG | TX_CMD_A_LAST_SEG | nLength;
 	*(u32 *) &pThis->m_pTxBuffer[4] = nLength;
@@ -334,63 +422,272 @@ boolean SMSC951xDeviceSendFrame (TSMSC951xDevice *pThis, const void *pBuffer, un
 	return DWHCIDeviceTransfer (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut, pThis->m_pTxBuffer, nLength+8) >= 0;
 }
 
-boolean SMSC951xDeviceReceiveFrame (TSMSC951xDevice *pThis, void *pBuffer, unsigned *pResultLength)
+// writes the TX command words in front of pFrame, returns where the transfer starts
+static u8 *SMSC951xDeviceWriteTxHeader (void *pFrame, unsigned nLength)
+{
+	UK_ASSERT (pFrame != 0);
+	u8 *pBuffer = (u8 *) pFrame - NET_FRAME_TX_HEADROOM;
+	UK_ASSERT (((uintptr) pBuffer & 3) == 0);
+
+	*(u32 *) &pBuffer[0] = TX_CMD_A_FIRST_SEG | TX_CMD_A_LAST_SEG | nLength;
+	*(u32 *) &pBuffer[4] = nLength;
+
+	return pBuffer;
+}
+
+boolean SMSC951xDeviceSendFrameInPlace (TSMSC951xDevice *pThis, void *pFrame, unsigned nLength)
 {
 	UK_ASSERT (pThis != 0);
 
-	UK_ASSERT (pThis->m_pEndpointBulkIn != 0);
-	UK_ASSERT (pBuffer != 0);
-	TUSBRequest URB;
-	USBRequest (&URB, pThis->m_pEndpointBulkIn, pBuffer, FRAME_BUFFER_SIZE, 0);
+	if (!NetFrameTxFits (nLength, FRAME_BUFFER_SIZE))
+	{
+		return FALSE;
+	}
 
-	if (!DWHCIDeviceSubmitBlockingRequest (USBFunctionGetHost (&pThis->m_USBFunction), &URB))
+	u8 *pBuffer = SMSC951xDeviceWriteTxHeader (pFrame, nLength);
+
+	UK_ASSERT (pThis->m_pEndpointBulkOut != 0);
+	return DWHCIDeviceTransfer (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut,
+				    pBuffer, nLength+NET_FRAME_TX_HEADROOM) >= 0;
+}
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+boolean SMSC951xDeviceSendFrameAsync (TSMSC951xDevice *pThis, void *pFrame, unsigned nLength,
+				   TNetFrameSentHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pHandler != 0);
+
+	if (!NetFrameTxFits (nLength, FRAME_BUFFER_SIZE))
 	{
-		_USBRequest (&URB);
+		return FALSE;
+	}
+
+	u8 *pBuffer = SMSC951xDeviceWriteTxHeader (pFrame, nLength);
+
+	return NetTxQueueSend (&pThis->m_TxQueue, USBFunctionGetHost (&pThis->m_USBFunction),
+			       pThis->m_pEndpointBulkOut, pBuffer, nLength+NET_FRAME_TX_HEADROOM, pHandler, pParam);
+}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+boolean SMSC951xDeviceQueueFrame (TSMSC951xDevice *pThis, const void *pBuffer, unsigned nLength)
+{
+	UK_ASSERT (pThis != 0);
 
+	if (!NetFrameTxFits (nLength, FRAME_BUFFER_SIZE))
+	{
 		return FALSE;
 	}
 
-	u32 nResultLength = USBRequestGetResultLength (&URB);
-	if (nResultLength < 4)				// should not happen with HW_CFG_BIR set
+	// each frame starts on a 4 byte boundary
+	UK_ASSERT (pThis->m_pTxBatch != 0);
+	unsigned nOffset = (pThis->m_nTxBatchLength + 3) & ~3;
+	u8 *pHeader = pThis->m_pTxBatch + nOffset;
+
+	UK_ASSERT (pBuffer != 0);
+	raspi_memcpy (pHeader+8, pBuffer, nLength);
+
+	*(u32 *) &pHeader[0] = TX_CMD_A_FIRST_SEG | TX_CMD_A_LAST_SEG | nLength;
+	*(u32 *) &pHeader[4] = nLength;
+
+	pThis->m_nTxBatchLength = nOffset + 8 + nLength;
+
+	// flush while the next frame is sure to fit, so queueing never has to
+	if (((pThis->m_nTxBatchLength + 3) & ~3) + FRAME_BUFFER_SIZE > TX_BATCH_SIZE)
 	{
-		_USBRequest (&URB);
+		return SMSC951xDeviceFlushFrames (pThis);
+	}
 
+	return TRUE;
+}
+
+boolean SMSC951xDeviceFlushFrames (TSMSC951xDevice *pThis)
+{
+	UK_ASSERT (pThis != 0);
+
+	unsigned nLength = pThis->m_nTxBatchLength;
+	if (nLength == 0)
+	{
+		return TRUE;
+	}
+	pThis->m_nTxBatchLength = 0;
+
+	UK_ASSERT (pThis->m_pEndpointBulkOut != 0);
+	return DWHCIDeviceTransfer (USBFunctionGetHost (&pThis->m_USBFunction), pThis->m_pEndpointBulkOut,
+				    pThis->m_pTxBatch, nLength) >= 0;
+}
+#endif
+
+boolean SMSC951xDeviceReceiveFrame (TSMSC951xDevice *pThis, void *pBuffer, unsigned *pResultLength)
+{
+	unsigned nFrameOffset;
+	if (!SMSC951xDeviceReceiveFrameInPlace (pThis, pBuffer, FRAME_BUFFER_SIZE,
+						pResultLength, &nFrameOffset))
+	{
 		return FALSE;
 	}
 
-	u32 nRxStatus = *(u32 *) pBuffer;
+	memmove (pBuffer, (u8 *) pBuffer + nFrameOffset, *pResultLength);	// overwrite RX status
+
+	return TRUE;
+}
+
+// returns the length of the frame (without CRC) received into pBuffer, 0 if there is none
+static unsigned SMSC951xDeviceGetFrameLength (const void *pBuffer, u32 nResultLength)
+{
+	if (nResultLength < 4)				// should not happen with HW_CFG_BIR set
+	{
+		return 0;
+	}
+
+	u32 nRxStatus = *(const u32 *) pBuffer;
 	if (nRxStatus & RX_STS_ERROR)
 	{
 		LogWrite (LOG_WARNING, "RX error (status 0x%X)", nRxStatus);
 
-		_USBRequest (&URB);
-
-		return FALSE;
+		return 0;
 	}
 	
 	u32 nFrameLength = RX_STS_FRAMELEN (nRxStatus);
 	UK_ASSERT (nFrameLength == nResultLength-4);
 	UK_ASSERT (nFrameLength > 4);
 	if (nFrameLength <= 4)
+	{
+		return 0;
+	}
+
+	//LogWrite (LOG_DEBUG, "Frame received (status 0x%X)", nRxStatus);
+
+	return nFrameLength - 4;	// ignore CRC
+}
+
+boolean SMSC951xDeviceReceiveFrameInPlace (TSMSC951xDevice *pThis, void *pBuffer, unsigned nBufSize,
+					   unsigned *pResultLength, unsigned *pFrameOffset)
+{
+	UK_ASSERT (pThis != 0);
+
+	UK_ASSERT (pThis->m_pEndpointBulkIn != 0);
+	UK_ASSERT (pBuffer != 0);
+	UK_ASSERT (nBufSize <= FRAME_BUFFER_SIZE);
+	TUSBRequest URB;
+	USBRequest (&URB, pThis->m_pEndpointBulkIn, pBuffer, nBufSize, 0);
+
+	if (!DWHCIDeviceSubmitBlockingRequest (USBFunctionGetHost (&pThis->m_USBFunction), &URB))
 	{
 		_USBRequest (&URB);
 
 		return FALSE;
 	}
-	nFrameLength -= 4;	// ignore CRC
 
-	//LogWrite (LOG_DEBUG, "Frame received (status 0x%X)", nRxStatus);
+	unsigned nFrameLength = SMSC951xDeviceGetFrameLength (pBuffer, USBRequestGetResultLength (&URB));
 
-	memcpy (pBuffer, (u8 *) pBuffer + 4, nFrameLength);	// overwrite RX status
+	_USBRequest (&URB);
+
+	if (nFrameLength == 0)
+	{
+		return FALSE;
+	}
 
 	UK_ASSERT (pResultLength != 0);
 	*pResultLength = nFrameLength;
-	
-	_USBRequest (&URB);
+	UK_ASSERT (pFrameOffset != 0);
+	*pFrameOffset = 4;
 
 	return TRUE;
 }
 
+#ifdef CONFIG_RASPI_NET_RX_INTR
+static void SMSC951xDeviceRxCompletionRoutine (TUSBRequest *pURB, void *pParam, void *pContext)
+{
+	TSMSC951xDevice *pThis = (TSMSC951xDevice *) pContext;
+	UK_ASSERT (pThis != 0);
+	TSMSC951xRxRequest *pRequest = (TSMSC951xRxRequest *) pParam;
+	UK_ASSERT (pRequest != 0);
+	UK_ASSERT (pURB == &pRequest->m_URB);
+
+	void *pBuffer = USBRequestGetBuffer (pURB);
+	unsigned nFrameLength = 0;
+
+	if (USBRequestGetStatus (pURB))
+	{
+		nFrameLength = SMSC951xDeviceGetFrameLength (pBuffer, USBRequestGetResultLength (pURB));
+		if (   nFrameLength == 0
+		    && DWHCIDeviceSubmitAsyncRequest (USBFunctionGetHost (&pThis->m_USBFunction), pURB))
+		{
+			return;
+		}
+	}
+
+	TSMSC951xFrameHandler *pHandler = pRequest->m_pHandler;
+	void *pHandlerParam = pRequest->m_pParam;
+
+	_USBRequest (pURB);
+	pRequest->m_bInUse = FALSE;
+
+	(*pHandler) (pBuffer, nFrameLength, 4, pHandlerParam);
+}
+
+boolean SMSC951xDeviceReceiveFrameAsync (TSMSC951xDevice *pThis, void *pBuffer, unsigned nBufSize,
+					 TSMSC951xFrameHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (pThis != 0);
+
+	UK_ASSERT (pThis->m_pEndpointBulkIn != 0);
+	UK_ASSERT (pBuffer != 0);
+	UK_ASSERT (((uintptr) pBuffer & (DMA_POOL_ALIGN-1)) == 0);
+	UK_ASSERT (nBufSize <= FRAME_BUFFER_SIZE);
+	UK_ASSERT (pHandler != 0);
+
+	TSMSC951xRxRequest *pRequest = 0;
+
+	uspi_EnterCritical ();
+	for (unsigned i = 0; i < RX_ASYNC_REQUESTS; i++)
+	{
+		if (!pThis->m_RxRequest[i].m_bInUse)
+		{
+			pRequest = &pThis->m_RxRequest[i];
+			pRequest->m_bInUse = TRUE;
+
+			break;
+		}
+	}
+	uspi_LeaveCritical ();
+
+	if (pRequest == 0)
+	{
+		return FALSE;
+	}
+
+	pRequest->m_pHandler = pHandler;
+	pRequest->m_pParam = pParam;
+
+	USBRequest (&pRequest->m_URB, pThis->m_pEndpointBulkIn, pBuffer, nBufSize, 0);
+	USBRequestSetCompletionRoutine (&pRequest->m_URB, SMSC951xDeviceRxCompletionRoutine, pRequest, pThis);
+
+	if (!DWHCIDeviceSubmitAsyncRequest (USBFunctionGetHost (&pThis->m_USBFunction), &pRequest->m_URB))
+	{
+		_USBRequest (&pRequest->m_URB);
+		pRequest->m_bInUse = FALSE;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+boolean SMSC951xDeviceReceiveFrameAggregated (TSMSC951xDevice *pThis, const void **ppFrame,
+					  unsigned *pResultLength)
+{
+	UK_ASSERT (pThis != 0);
+
+	return NetRxBatchGetFrame (&pThis->m_RxBatch, USBFunctionGetHost (&pThis->m_USBFunction),
+				   pThis->m_pEndpointBulkIn, ppFrame, pResultLength);
+}
+#endif
+
 boolean SMSC951xDeviceIsLinkUp (TSMSC951xDevice *pThis)
 {
 	UK_ASSERT (pThis != 0);
@@ -404,6 +701,64 @@ boolean SMSC951xDeviceIsLinkUp (TSMSC951xDevice *pThis)
 	return usPHYModeStatus & (1 << 2) ? TRUE : FALSE;
 }
 
+boolean SMSC951xDeviceSetRxFilter (TSMSC951xDevice *pThis, boolean bPromisc, boolean bAllMulticast,
+				   const u8 *pMulticast, unsigned nCount)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pMulticast != 0 || nCount == 0);
+
+	u32 nHashHigh = 0;
+	u32 nHashLow = 0;
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		TMACAddress Address;
+		MACAddress2 (&Address, pMulticast + i * MAC_ADDRESS_SIZE);
+
+		unsigned nBit = (MACAddressGetCRC (&Address) >> 26) & 0x3F;
+		if (nBit & 0x20)
+		{
+			nHashHigh |= 1U << (nBit & 0x1F);
+		}
+		else
+		{
+			nHashLow |= 1U << (nBit & 0x1F);
+		}
+
+		_MACAddress (&Address);
+	}
+
+	u32 nMACControl;
+	if (!SMSC951xDeviceReadReg (pThis, MAC_CR, &nMACControl))
+	{
+		return FALSE;
+	}
+
+	nMACControl &= ~(MAC_CR_PRMS | MAC_CR_MCPAS | MAC_CR_HPFILT);
+	if (bPromisc)
+	{
+		nMACControl |= MAC_CR_PRMS;
+	}
+	else if (bAllMulticast)
+	{
+		nMACControl |= MAC_CR_MCPAS;
+	}
+	else if (nCount > 0)
+	{
+		nMACControl |= MAC_CR_HPFILT;
+	}
+
+	if (   !SMSC951xDeviceWriteReg (pThis, HASHH, nHashHigh)
+	    || !SMSC951xDeviceWriteReg (pThis, HASHL, nHashLow)
+	    || !SMSC951xDeviceWriteReg (pThis, MAC_CR, nMACControl))
+	{
+		LogWrite (LOG_ERROR, "Cannot set receive filter");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 boolean SMSC951xDevicePHYWrite (TSMSC951xDevice *pThis, u8 uchIndex, u16 usValue)
 {
 	UK_ASSERT (pThis != 0);
@@ -79,7 +79,10 @@ boolean TimerInitialize (TTimer *pThis)
 
 	write32 (ARM_SYSTIMER_C3, read32 (ARM_SYSTIMER_CLO) + CLOCKHZ / HZ);
 	
+#ifndef CONFIG_RASPI_USB_FASTBOOT
+	// m_nMsDelay is only used by the busy-loop delays, which are not built
 	TimerTuneMsDelay (pThis);
+#endif
 
 	DataMemBarrier ();
 
@@ -18,8 +18,16 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <uspi/usbendpoint.h>
+#include <uspi/usbrequest.h>
 #include <uk/assert.h>
 
+static void USBEndpointInitRequests (TUSBEndpoint *pThis)
+{
+	pThis->m_bActive = FALSE;
+	pThis->m_pPendingHead = 0;
+	pThis->m_pPendingTail = 0;
+}
+
 void USBEndpoint (TUSBEndpoint *pThis, TUSBDevice *pDevice)
 {
 	UK_ASSERT (pThis != 0);
@@ -30,6 +38,7 @@ void USBEndpoint (TUSBEndpoint *pThis, TUSBDevice *pDevice)
 	pThis->m_nMaxPacketSize = USB_DEFAULT_MAX_PACKET_SIZE;
 	pThis->m_nInterval = 1;
 	pThis->m_NextPID = USBPIDSetup;
+	USBEndpointInitRequests (pThis);
 
 	UK_ASSERT (pThis->m_pDevice != 0);
 }
@@ -39,6 +48,7 @@ void USBEndpoint2 (TUSBEndpoint *pThis, TUSBDevice *pDevice, const TUSBEndpointD
 	UK_ASSERT (pThis != 0);
 	pThis->m_pDevice = pDevice;
 	pThis->m_nInterval = 1;
+	USBEndpointInitRequests (pThis);
 
 	UK_ASSERT (pThis->m_pDevice != 0);
 
@@ -117,6 +127,7 @@ void USBEndpointCopy (TUSBEndpoint *pThis, TUSBEndpoint *pEndpoint, TUSBDevice *
 	pThis->m_nMaxPacketSize  = pEndpoint->m_nMaxPacketSize;
 	pThis->m_nInterval       = pEndpoint->m_nInterval;
 	pThis->m_NextPID	 = pEndpoint->m_NextPID;
+	USBEndpointInitRequests (pThis);
 }
 
 void _USBEndpoint (TUSBEndpoint *pThis)
@@ -232,3 +243,54 @@ void USBEndpointResetPID (TUSBEndpoint *pThis)
 
 	pThis->m_NextPID = USBPIDData0;
 }
+
+boolean USBEndpointBeginRequest (TUSBEndpoint *pThis, TUSBRequest *pURB)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pThis->m_Type != EndpointTypeControl);
+	UK_ASSERT (pURB != 0);
+
+	if (!pThis->m_bActive)
+	{
+		UK_ASSERT (pThis->m_pPendingHead == 0);
+		pThis->m_bActive = TRUE;
+
+		return TRUE;
+	}
+
+	pURB->m_pNext = 0;
+	if (pThis->m_pPendingTail != 0)
+	{
+		pThis->m_pPendingTail->m_pNext = pURB;
+	}
+	else
+	{
+		pThis->m_pPendingHead = pURB;
+	}
+	pThis->m_pPendingTail = pURB;
+
+	return FALSE;
+}
+
+TUSBRequest *USBEndpointEndRequest (TUSBEndpoint *pThis)
+{
+	UK_ASSERT (pThis != 0);
+	UK_ASSERT (pThis->m_bActive);
+
+	TUSBRequest *pURB = pThis->m_pPendingHead;
+	if (pURB == 0)
+	{
+		pThis->m_bActive = FALSE;
+
+		return 0;
+	}
+
+	pThis->m_pPendingHead = pURB->m_pNext;
+	if (pThis->m_pPendingHead == 0)
+	{
+		pThis->m_pPendingTail = 0;
+	}
+	pURB->m_pNext = 0;
+
+	return pURB;
+}
@@ -33,6 +33,12 @@ void USBRequest (TUSBRequest *pThis, TUSBEndpoint *pEndpoint, void *pBuffer, u32
 	pThis->m_pCompletionRoutine = 0;
 	pThis->m_pCompletionParam = 0;
 	pThis->m_pCompletionContext = 0;
+	pThis->m_pNext = 0;
+	pThis->m_bWaiting = FALSE;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	pThis->m_bSleeping = FALSE;
+	uk_semaphore_init (&pThis->m_Completion, 0);
+#endif
 
 	UK_ASSERT (pThis->m_pEndpoint != 0);
 	UK_ASSERT (pThis->m_pBuffer != 0 || pThis->m_nBufLen == 0);
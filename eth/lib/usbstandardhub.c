@@ -19,6 +19,7 @@
 //
 #include <uspi/usbstandardhub.h>
 #include <uspi/usbdevicefactory.h>
+#include <uspi/dmapool.h>
 #include <uspios.h>
 #include <uspi/macros.h>
 #include <uk/assert.h>
@@ -53,7 +54,7 @@ void _USBStandardHub (TUSBStandardHub *pThis)
 	{
 		if (pThis->m_pStatus[nPort] != 0)
 		{
-			free (pThis->m_pStatus[nPort]);
+			DMAPoolFree (pThis->m_pStatus[nPort]);
 			pThis->m_pStatus[nPort] = 0;
 		}
 
@@ -69,7 +70,7 @@ void _USBStandardHub (TUSBStandardHub *pThis)
 
 	if (pThis->m_pHubDesc != 0)
 	{
-		free (pThis->m_pHubDesc);
+		DMAPoolFree (pThis->m_pHubDesc);
 		pThis->m_pHubDesc = 0;
 	}
 
@@ -110,7 +111,7 @@ boolean USBStandardHubConfigure (TUSBFunction *pUSBFunction)
 	UK_ASSERT (pHost != 0);
 
 	UK_ASSERT (pThis->m_pHubDesc == 0);
-	pThis->m_pHubDesc = (TUSBHubDescriptor *) malloc (sizeof (TUSBHubDescriptor));
+	pThis->m_pHubDesc = (TUSBHubDescriptor *) DMAPoolAllocate (sizeof (TUSBHubDescriptor));
 	UK_ASSERT (pThis->m_pHubDesc != 0);
 
 	if (DWHCIDeviceGetDescriptor (pHost, USBFunctionGetEndpoint0 (&pThis->m_USBFunction),
@@ -121,7 +122,7 @@ boolean USBStandardHubConfigure (TUSBFunction *pUSBFunction)
 	{
 		LogWrite (LOG_ERROR, "Cannot get hub descriptor");
 		
-		free (pThis->m_pHubDesc);
+		DMAPoolFree (pThis->m_pHubDesc);
 		pThis->m_pHubDesc = 0;
 		
 		return FALSE;
@@ -136,7 +137,7 @@ boolean USBStandardHubConfigure (TUSBFunction *pUSBFunction)
 	{
 		LogWrite (LOG_ERROR, "Too many ports (%u)", pThis->m_nPorts);
 		
-		free (pThis->m_pHubDesc);
+		DMAPoolFree (pThis->m_pHubDesc);
 		pThis->m_pHubDesc = 0;
 		
 		return FALSE;
@@ -177,15 +178,20 @@ boolean USBStandardHubEnumeratePorts (TUSBStandardHub *pThis)
 		}
 	}
 
+#ifdef CONFIG_RASPI_USB_FASTBOOT
+	// bPwrOn2PwrGood is given in 2ms units
+	MsDelay (pThis->m_pHubDesc->bPwrOn2PwrGood * 2);
+#else
 	// pThis->m_pHubDesc->bPwrOn2PwrGood delay seems to be not enough
 	// for some low speed devices, so we use the maximum here
 	MsDelay (510);
+#endif
 
 	// now detect devices, reset and initialize them
 	for (unsigned nPort = 0; nPort < pThis->m_nPorts; nPort++)
 	{
 		UK_ASSERT (pThis->m_pStatus[nPort] == 0);
-		pThis->m_pStatus[nPort] = malloc (sizeof (TUSBPortStatus));
+		pThis->m_pStatus[nPort] = DMAPoolAllocate (sizeof (TUSBPortStatus));
 		UK_ASSERT (pThis->m_pStatus[nPort] != 0);
 
 		if (DWHCIDeviceControlMessage (pHost, pEndpoint0,
@@ -212,6 +218,25 @@ boolean USBStandardHubEnumeratePorts (TUSBStandardHub *pThis)
 			continue;
 		}
 
+#ifdef CONFIG_RASPI_USB_FASTBOOT
+		// the hub times the reset itself (10-20ms), poll until it is done
+		unsigned nPoll = 0;
+		do
+		{
+			MsDelay (USB_THUBRESET_POLL);
+
+			if (DWHCIDeviceControlMessage (pHost, pEndpoint0,
+				REQUEST_IN | REQUEST_CLASS | REQUEST_TO_OTHER,
+				GET_STATUS, 0, nPort+1, pThis->m_pStatus[nPort], 4) != 4)
+			{
+				return FALSE;
+			}
+		}
+		while (   (pThis->m_pStatus[nPort]->wPortStatus & PORT_RESET__MASK)
+		       && ++nPoll < 100 / USB_THUBRESET_POLL);
+
+		MsDelay (USB_TRSTRCY);
+#else
 		MsDelay (100);
 		
 		if (DWHCIDeviceControlMessage (pHost, pEndpoint0,
@@ -220,6 +245,7 @@ boolean USBStandardHubEnumeratePorts (TUSBStandardHub *pThis)
 		{
 			return FALSE;
 		}
+#endif
 
 		//LogWrite (LOG_DEBUG, "Port %u status is 0x%04X", nPort+1, (unsigned) pThis->m_pStatus[nPort]->wPortStatus);
 		
@@ -313,7 +339,7 @@ boolean USBStandardHubEnumeratePorts (TUSBStandardHub *pThis)
 	}
 
 	// again check for over-current
-	TUSBHubStatus *pHubStatus = malloc (sizeof (TUSBHubStatus));
+	TUSBHubStatus *pHubStatus = DMAPoolAllocate (sizeof (TUSBHubStatus));
 	UK_ASSERT (pHubStatus != 0);
 
 	if (DWHCIDeviceControlMessage (pHost, pEndpoint0,
@@ -322,7 +348,7 @@ boolean USBStandardHubEnumeratePorts (TUSBStandardHub *pThis)
 	{
 		LogWrite (LOG_ERROR, "Cannot get hub status");
 
-		free (pHubStatus);
+		DMAPoolFree (pHubStatus);
 
 		return FALSE;
 	}
@@ -338,12 +364,12 @@ boolean USBStandardHubEnumeratePorts (TUSBStandardHub *pThis)
 
 		LogWrite (LOG_ERROR, "Hub over-current condition");
 
-		free (pHubStatus);
+		DMAPoolFree (pHubStatus);
 
 		return FALSE;
 	}
 
-	free (pHubStatus);
+	DMAPoolFree (pHubStatus);
 	pHubStatus = 0;
 
 	boolean bResult = TRUE;
@@ -26,6 +26,7 @@
 #include <uspienv/util.h>
 #include <uspienv/assert.h>
 #include <uk/assert.h>
+#include <raspi/time.h>
 #include <time.h>
 #include <errno.h>
 
@@ -56,6 +57,15 @@ void MsDelay (unsigned nMilliSeconds)
 
 void usDelay (unsigned nMicroSeconds)
 {
+#ifdef CONFIG_RASPI_USB_FASTBOOT
+	// Too short to be worth a trip through the scheduler
+	if (nMicroSeconds < 1000)
+	{
+		raspi_udelay (nMicroSeconds);
+		return;
+	}
+#endif
+
     long us = nMicroSeconds;
 
     struct timespec ts;
@@ -68,7 +78,7 @@ void usDelay (unsigned nMicroSeconds)
     }
 
     ts.tv_sec = us / 1000000;
-    ts.tv_nsec = us % 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
 
     do {
         res = nanosleep(&ts, &ts);
@@ -21,11 +21,16 @@
 #include <uspi.h>
 #include <uspios.h>
 #include <uspi/usbfunction.h>
+#include <uspi/netframe.h>
 #include <uspi/string.h>
 #include <uspi/util.h>
 #include <uk/assert.h>
 #include <stdlib.h>
 
+#if USPI_FRAME_TX_HEADROOM != NET_FRAME_TX_HEADROOM
+	#error USPI_FRAME_TX_HEADROOM must match the room the drivers need for the TX command words
+#endif
+
 static TUSPiLibrary *s_pLibrary = 0;
 
 int USPiInitialize (void)
@@ -249,6 +254,61 @@ int USPiEthernetIsLinkUp (void)
 	return SMSC951xDeviceIsLinkUp (s_pLibrary->pEth0) ? 1 : 0;
 }
 
+int USPiEthernetMaxMTU (void)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800_MAX_MTU;
+	}
+
+	return SMSC951X_MAX_MTU;
+}
+
+int USPiEthernetSetMTU (unsigned nMTU)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceSetMTU (s_pLibrary->pEth10, nMTU) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	return nMTU <= SMSC951X_MAX_MTU ? 1 : 0;
+}
+
+int USPiEthernetRxBufferSize (unsigned nMTU)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceGetRxBufferSize (s_pLibrary->pEth10, nMTU);
+	}
+
+	return FRAME_BUFFER_SIZE;
+}
+
+int USPiEthernetSetRxFilter (unsigned nFlags, const unsigned char *pMulticast, unsigned nCount)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	boolean bPromisc = nFlags & USPI_RX_PROMISC ? TRUE : FALSE;
+	boolean bAllMulticast = nFlags & USPI_RX_ALLMULTI ? TRUE : FALSE;
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceSetRxFilter (s_pLibrary->pEth10, bPromisc, bAllMulticast,
+						 pMulticast, nCount) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	return SMSC951xDeviceSetRxFilter (s_pLibrary->pEth0, bPromisc, bAllMulticast,
+					  pMulticast, nCount) ? 1 : 0;
+}
+
 int USPiSendFrame (const void *pBuffer, unsigned nLength)
 {
 	UK_ASSERT (s_pLibrary != 0);
@@ -262,6 +322,132 @@ int USPiSendFrame (const void *pBuffer, unsigned nLength)
 	return SMSC951xDeviceSendFrame (s_pLibrary->pEth0, pBuffer, nLength) ? 1 : 0;
 }
 
+// maps USPI_FRAME_TX_* to LAN7800_TX_*
+static unsigned USPiLAN7800TxFlags (unsigned nFlags)
+{
+	unsigned nResult = (nFlags & USPI_FRAME_TX_CSUM) ? LAN7800_TX_CSUM : 0;
+
+	if (nFlags & USPI_FRAME_TX_TSO)
+	{
+		nResult |= LAN7800_TX_LSO | LAN7800_TX_MSS ((nFlags >> 16) & 0x3FFF);
+	}
+
+	return nResult;
+}
+
+int USPiEthernetChecksumOffload (void)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+	return s_pLibrary->pEth10 != 0 ? 1 : 0;
+#else
+	return 0;
+#endif
+}
+
+int USPiEthernetSegmentationOffload (void)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+#ifdef CONFIG_RASPI_NET_TSO
+	return s_pLibrary->pEth10 != 0 ? 1 : 0;
+#else
+	return 0;
+#endif
+}
+
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+int USPiFrameChecksumValid (const void *pFrame)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceFrameChecksumValid (s_pLibrary->pEth10, pFrame) ? 1 : 0;
+	}
+
+	return 0;
+}
+#endif
+
+int USPiSendFrameInPlace (void *pFrame, unsigned nLength, unsigned nFlags)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceSendFrameInPlace (s_pLibrary->pEth10, pFrame, nLength,
+						      USPiLAN7800TxFlags (nFlags)) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	UK_ASSERT (nFlags == 0);
+	return SMSC951xDeviceSendFrameInPlace (s_pLibrary->pEth0, pFrame, nLength) ? 1 : 0;
+}
+
+int USPiEthernetTxMaxLength (unsigned nFlags)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return (nFlags & USPI_FRAME_TX_TSO) ? LAN7800_TX_LSO_MAX_SIZE
+						    : LAN7800_FRAME_BUFFER_SIZE - NET_FRAME_TX_HEADROOM;
+	}
+
+	UK_ASSERT (nFlags == 0);
+	return FRAME_BUFFER_SIZE - NET_FRAME_TX_HEADROOM;
+}
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+int USPiSendFrameAsync (void *pFrame, unsigned nLength, unsigned nFlags,
+			TUSPiFrameSentHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceSendFrameAsync (s_pLibrary->pEth10, pFrame, nLength,
+						    USPiLAN7800TxFlags (nFlags), pHandler, pParam) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	UK_ASSERT (nFlags == 0);
+	return SMSC951xDeviceSendFrameAsync (s_pLibrary->pEth0, pFrame, nLength, pHandler, pParam) ? 1 : 0;
+}
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+int USPiQueueFrame (const void *pBuffer, unsigned nLength, unsigned nFlags)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceQueueFrame (s_pLibrary->pEth10, pBuffer, nLength,
+						USPiLAN7800TxFlags (nFlags)) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	UK_ASSERT (nFlags == 0);
+	return SMSC951xDeviceQueueFrame (s_pLibrary->pEth0, pBuffer, nLength) ? 1 : 0;
+}
+
+int USPiFlushFrames (void)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceFlushFrames (s_pLibrary->pEth10) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	return SMSC951xDeviceFlushFrames (s_pLibrary->pEth0) ? 1 : 0;
+}
+#endif
+
 int USPiReceiveFrame (void *pBuffer, unsigned *pResultLength)
 {
 	UK_ASSERT (s_pLibrary != 0);
@@ -275,6 +461,62 @@ int USPiReceiveFrame (void *pBuffer, unsigned *pResultLength)
 	return SMSC951xDeviceReceiveFrame (s_pLibrary->pEth0, pBuffer, pResultLength) ? 1 : 0;
 }
 
+int USPiReceiveFrameInPlace (void *pBuffer, unsigned nBufSize, unsigned *pResultLength,
+			     unsigned *pFrameOffset)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceReceiveFrameInPlace (s_pLibrary->pEth10, pBuffer, nBufSize,
+							 pResultLength, pFrameOffset) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	return SMSC951xDeviceReceiveFrameInPlace (s_pLibrary->pEth0, pBuffer, nBufSize,
+						  pResultLength, pFrameOffset) ? 1 : 0;
+}
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+int USPiReceiveFrameAggregated (const void **ppFrame, unsigned *pResultLength)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceReceiveFrameAggregated (s_pLibrary->pEth10, ppFrame, pResultLength) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	return SMSC951xDeviceReceiveFrameAggregated (s_pLibrary->pEth0, ppFrame, pResultLength) ? 1 : 0;
+}
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+int USPiReceiveFrameAsync (void *pBuffer, unsigned nBufSize,
+			   TUSPiFrameReceivedHandler *pHandler, void *pParam)
+{
+	UK_ASSERT (s_pLibrary != 0);
+
+	if (s_pLibrary->pEth10 != 0)
+	{
+		return LAN7800DeviceReceiveFrameAsync (s_pLibrary->pEth10, pBuffer, nBufSize,
+						       pHandler, pParam) ? 1 : 0;
+	}
+
+	UK_ASSERT (s_pLibrary->pEth0 != 0);
+	return SMSC951xDeviceReceiveFrameAsync (s_pLibrary->pEth0, pBuffer, nBufSize,
+						pHandler, pParam) ? 1 : 0;
+}
+#endif
+
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+void USPiCycleTraceDump (void)
+{
+	DWHCIDeviceCycleTraceDump ();
+}
+#endif
+
 int USPiGamePadAvailable (void)
 {
 	UK_ASSERT (s_pLibrary != 0);
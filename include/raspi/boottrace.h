@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Boot timeline tracer (CONFIG_RASPI_BOOTTRACE)
+ *
+ * Boot stages are recorded as spans with system timer (1 MHz) timestamps
+ * into a static buffer and dumped over the console, either as a table or as
+ * Chrome trace JSON (chrome://tracing, Perfetto).
+ */
+
+#ifndef __RASPI_BOOTTRACE_H__
+#define __RASPI_BOOTTRACE_H__
+
+/* Timestamps taken by start.S before there is a C environment */
+#define BOOTTRACE_STAMP_ENTRY		0	/* _start */
+#define BOOTTRACE_STAMP_MEMSPLIT	1	/* firmware memory split query */
+#define BOOTTRACE_STAMP_PAGETABLES	2	/* create_page_tables */
+#define BOOTTRACE_STAMP_MMU		3	/* MMU enable */
+#define BOOTTRACE_STAMP_BSS		4	/* .bss clear */
+#define BOOTTRACE_STAMP_C_ENTRY		5	/* jump to _libraspiplat_entry */
+#define BOOTTRACE_STAMP_COUNT		6
+
+#ifndef __ASSEMBLY__
+
+#include <uk/config.h>
+#include <stdint.h>
+
+#ifdef CONFIG_RASPI_BOOTTRACE
+
+/* Converts the start.S timestamps into records, called first thing in C */
+void raspi_boottrace_init(void);
+
+/* Opens a span and returns its handle, or -1 if the buffer is full */
+int raspi_boottrace_begin(const char *name);
+void raspi_boottrace_end(int handle);
+
+/* Adds a span with explicit timestamps */
+void raspi_boottrace_record(const char *name, uint64_t start, uint64_t end);
+
+/* Prints all records in the configured format */
+void raspi_boottrace_dump(void);
+
+#else /* !CONFIG_RASPI_BOOTTRACE */
+
+static inline void raspi_boottrace_init(void) {}
+static inline int raspi_boottrace_begin(const char *name __attribute__((unused))) { return -1; }
+static inline void raspi_boottrace_end(int handle __attribute__((unused))) {}
+static inline void raspi_boottrace_record(const char *name __attribute__((unused)),
+					  uint64_t start __attribute__((unused)),
+					  uint64_t end __attribute__((unused))) {}
+static inline void raspi_boottrace_dump(void) {}
+
+#endif /* CONFIG_RASPI_BOOTTRACE */
+
+#endif /* !__ASSEMBLY__ */
+
+#endif /* __RASPI_BOOTTRACE_H__ */
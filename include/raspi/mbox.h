@@ -45,9 +45,34 @@ extern volatile unsigned int mbox[MBOX_BUFFER_LENGTH];
 #define MBOX_CH_PROP    8
 
 /* Tags */
+#define MBOX_TAG_GETARMMEM      0x10005
+#define MBOX_TAG_GETVCMEM       0x10006
 #define MBOX_TAG_SETPOWER       0x28001
 #define MBOX_TAG_SETCLKRATE     0x38002
 #define MBOX_TAG_LAST           0
 
+/* MBOX_TAG_SETPOWER */
+#define MBOX_POWER_DEVICE_USB   3
+#define MBOX_POWER_ON           (1 << 0)
+#define MBOX_POWER_WAIT         (1 << 1)
+
 int mbox_call(unsigned char ch);
+
+/* ARM/VideoCore memory split as reported by the firmware */
+extern unsigned long raspi_arm_mem_base;
+extern unsigned long raspi_arm_mem_size;
+extern unsigned long raspi_vc_mem_base;
+extern unsigned long raspi_vc_mem_size;
+
+/**
+ * Query the memory split from the firmware. Called from start.S with the MMU
+ * still off, before the page tables are built.
+ */
+void mbox_get_mem_split(void);
+
+/**
+ * Set the power state of a firmware managed device. Without MBOX_POWER_WAIT
+ * the firmware returns before the device is stable.
+ */
+int mbox_set_power_state(unsigned int device, unsigned int state);
 #endif /* __RASPI_MBOX_H__ */
@@ -62,6 +62,9 @@
 #define PUD_SHIFT			PAGE_SHIFT + 2*TABLE_SHIFT
 #define PMD_SHIFT			PAGE_SHIFT + TABLE_SHIFT
 
+/* PGD, PUD-0, PMD-0, spare, PMD for the local-INTC. The L3 tables for the
+ * kernel image follow at _pagetables_l3 (see link.lds.S).
+ */
 #define PG_DIR_SIZE			(5 * PAGE_SIZE)
 
 #endif /* __RASPI_MM_H__ */
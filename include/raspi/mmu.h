@@ -34,6 +34,13 @@
 #define MM_TYPE_BLOCK			0x1
 #define MM_ACCESS			(0x1 << 10)
 #define MM_ACCESS_PERMISSION		(0x01 << 6) 
+#define MM_SH_INNER			(0x3 << 8)
+#define MM_AP_RDONLY			(0x1 << 7)	/* AP[2]: no writes */
+#define MM_CONT				(0x1 << 52)	/* contiguous hint */
+#define MM_PXN				(0x1 << 53)
+#define MM_UXN				(0x1 << 54)
+#define MM_XN				(MM_PXN | MM_UXN)
+#define MM_CONT_ENTRIES			16		/* entries per contiguous group */
 
 /*
  * Memory region attributes:
@@ -42,21 +49,43 @@
  *			n	MAIR
  *   DEVICE_nGnRnE	000	00000000
  *   NORMAL_NC		001	01000100
+ *   NORMAL		010	11111111 (Inner/Outer Write-Back, RW-allocate)
  */
 #define MT_DEVICE_nGnRnE 		0x0
 #define MT_NORMAL_NC			0x1
+#define MT_NORMAL			0x2
 #define MT_DEVICE_nGnRnE_FLAGS		0x00
-#define MT_NORMAL_NC_FLAGS  		0xFF
-#define MAIR_VALUE			(MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) | (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC))
+#define MT_NORMAL_NC_FLAGS  		0x44
+#define MT_NORMAL_FLAGS			0xFF
+#define MAIR_VALUE			((MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) | \
+					 (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC)) | \
+					 (MT_NORMAL_FLAGS << (8 * MT_NORMAL)))
 
-#define MMU_FLAGS	 		(MM_TYPE_BLOCK | (MT_NORMAL_NC << 2) | MM_ACCESS)	
-#define MMU_DEVICE_FLAGS		(MM_TYPE_BLOCK | (MT_DEVICE_nGnRnE << 2) | MM_ACCESS)	
-#define MMU_PTE_FLAGS			(MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS | MM_ACCESS_PERMISSION)	
+/* RAM is cacheable and inner shareable so that all four cores stay coherent */
+#define MMU_FLAGS	 		(MM_TYPE_BLOCK | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | MM_XN)
+/* Uncached window for buffers shared with the VideoCore or the USB DMA engine */
+#define MMU_NC_FLAGS			(MM_TYPE_BLOCK | (MT_NORMAL_NC << 2) | MM_SH_INNER | MM_ACCESS | MM_XN)
+#define MMU_DEVICE_FLAGS		(MM_TYPE_BLOCK | (MT_DEVICE_nGnRnE << 2) | MM_ACCESS | MM_XN)
+#define MMU_PTE_FLAGS			(MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | MM_ACCESS_PERMISSION)
+
+/* Kernel image, mapped with 4 KiB pages so that no page is both writable and executable */
+#define MMU_TEXT_FLAGS			(MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | MM_AP_RDONLY | MM_UXN)
+#define MMU_RODATA_FLAGS		(MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | MM_AP_RDONLY | MM_XN)
+#define MMU_DATA_FLAGS			(MM_TYPE_PAGE | (MT_NORMAL << 2) | MM_SH_INNER | MM_ACCESS | MM_XN)
 
 #define TCR_T0SZ			(64 - 48) 
 #define TCR_T1SZ			((64 - 48) << 16)
 #define TCR_TG0_4K			(0 << 14)
 #define TCR_TG1_4K			(2 << 30)
-#define TCR_VALUE			(TCR_T0SZ | TCR_T1SZ | TCR_TG0_4K | TCR_TG1_4K)
+/* Let the table walker hit in the caches, the tables live in cacheable RAM */
+#define TCR_IRGN0_WBWA			(1 << 8)
+#define TCR_ORGN0_WBWA			(1 << 10)
+#define TCR_SH0_INNER			(3 << 12)
+#define TCR_IRGN1_WBWA			(1 << 24)
+#define TCR_ORGN1_WBWA			(1 << 26)
+#define TCR_SH1_INNER			(3 << 28)
+#define TCR_VALUE			(TCR_T0SZ | TCR_T1SZ | TCR_TG0_4K | TCR_TG1_4K | \
+					 TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | TCR_SH0_INNER | \
+					 TCR_IRGN1_WBWA | TCR_ORGN1_WBWA | TCR_SH1_INNER)
 
 #endif /* __RASPI_MMU_H__ */
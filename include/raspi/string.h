@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Optimized AArch64 string primitives (mm.S)
+ */
+
+#ifndef __RASPI_STRING_H__
+#define __RASPI_STRING_H__
+
+#include <uk/config.h>
+#include <stddef.h>
+
+/* Like memcpy(), buffers must not overlap */
+void *raspi_memcpy(void *dst, const void *src, size_t n);
+void *raspi_memset(void *dst, int c, size_t n);
+void memzero(void *dst, unsigned long n);
+
+#ifdef CONFIG_RASPI_STRING_BENCH
+/* Compare the primitives above against the old loops and print the result */
+void raspi_string_bench(void);
+#endif
+
+#endif /* __RASPI_STRING_H__ */
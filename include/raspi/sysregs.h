@@ -32,6 +32,24 @@
 #define DEVICE_BASE		(0x3F000000)
 #define MMIO_BASE		(DEVICE_BASE)
 
+/* ARM memory end used when the firmware cannot be asked for the ARM/VideoCore
+ * memory split (see mbox_get_mem_split()).
+ */
+#define ARM_MEM_DEFAULT_END	(DEVICE_BASE / 2)
+
+/* The topmost 2 MiB section of the ARM memory is mapped Normal Non-Cacheable.
+ * It holds buffers that are shared with the VideoCore or the USB DMA engine
+ * and therefore must not sit behind the ARM data cache.
+ */
+#define DMA_NC_SIZE		(0x00200000)
+
+#ifndef __ASSEMBLY__
+extern unsigned long raspi_dma_nc_base;
+
+#define DMA_NC_BASE		(raspi_dma_nc_base)
+#define DMA_NC_END		(DMA_NC_BASE + DMA_NC_SIZE)
+#endif /* !__ASSEMBLY__ */
+
 #define GPFSEL0         ((volatile unsigned int*)(MMIO_BASE+0x00200000))
 #define GPFSEL1         ((volatile unsigned int*)(MMIO_BASE+0x00200004))
 #define GPFSEL2         ((volatile unsigned int*)(MMIO_BASE+0x00200008))
@@ -64,6 +82,16 @@
 #define SCTLR_EL1_VALUE_MMU_ENABLED		(SCTLR_EL1_WFE_NORMAL | SCTLR_EL1_WFI_NORMAL | SCTLR_EL1_MMU_ENABLED | SCTLR_EL1_I_CACHE_ENABLED | SCTLR_EL1_D_CACHE_ENABLED)
 #define SCTLR_EL2_VALUE				(0)
 
+// ***************************************
+// CPUECTLR_EL1, CPU Extended Control Register, Cortex-A53 TRM 4.5.73.
+// Writable from EL2 because the firmware armstub grants access in ACTLR_EL3.
+// ***************************************
+#define CPUECTLR_EL1					S3_1_C15_C2_1
+#define CPUECTLR_EL1_SMPEN				(1 << 6)
+
+// How long core 0 waits for the secondary cores to park (system timer ticks)
+#define SMP_WAKE_TIMEOUT_US				100000
+
 // ***************************************
 // HCR_EL2, Hypervisor Configuration Register (EL2), Page 2487 of AArch64-Reference-Manual.
 // ***************************************
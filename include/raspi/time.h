@@ -85,6 +85,7 @@
 
 void raspi_irq_delay_measurements_init(void);
 uint64_t get_system_timer(void);
+void raspi_udelay(uint32_t us);
 uint32_t get_timer_irq_delay(void);
 void reset_timer_irq_delay(void);
 
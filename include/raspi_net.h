@@ -1,6 +1,45 @@
 #ifndef __RASPI_NET_H__
 #define __RASPI_NET_H__
 
+#include <uk/config.h>
 #include <uspienv.h>
 
+struct uk_netdev;
+struct uk_hwaddr;
+
+/*
+ * Replaces the list of multicast addresses the device receives. Frames to
+ * other multicast addresses are dropped by the device's receive filter,
+ * unless the device is in promiscuous mode. A list that does not fit lets
+ * all multicast frames pass.
+ */
+int raspi_net_mcast_set(struct uk_netdev *dev, const struct uk_hwaddr *addrs,
+			unsigned count);
+
+#ifdef CONFIG_RASPI_NET_ASYNC_START
+
+/*
+ * With RASPI_NET_ASYNC_START, uk_netdev_start() returns before the USB
+ * device is enumerated. Until the bring-up thread reports the link, the
+ * device receives nothing and fails transmissions with -ENETDOWN.
+ */
+typedef void (*raspi_net_link_cb_t)(struct uk_netdev *dev, int link_up,
+				    void *argp);
+
+/* Called once when the bring-up finishes (or at once if it already has) */
+void raspi_net_link_cb_set(raspi_net_link_cb_t cb, void *argp);
+
+/* Blocks until the bring-up finishes, returns 1 if the link is up */
+int raspi_net_link_wait(void);
+#endif /* CONFIG_RASPI_NET_ASYNC_START */
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+/*
+ * With RASPI_NET_TX_BATCH, transmitted frames are collected and sent in one
+ * USB transfer when the batch is full or RASPI_NET_TX_BATCH_TIMEOUT_US after
+ * the first one was queued. This sends whatever is queued right away.
+ */
+void raspi_net_tx_flush(void);
+#endif /* CONFIG_RASPI_NET_TX_BATCH */
+
 #endif /* __RASPI_NET_H__ */
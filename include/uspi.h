@@ -22,6 +22,8 @@
 #ifndef _uspi_h
 #define _uspi_h
 
+#include <uk/config.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -141,11 +143,113 @@ int USPiEthernetIsLinkUp (void);
 // returns 0 on failure
 int USPiSendFrame (const void *pBuffer, unsigned nLength);
 
+// returns the largest MTU the device can receive (1500 on the SMSC951x)
+int USPiEthernetMaxMTU (void);
+
+// sets the maximum size of received frames, returns 0 on failure
+int USPiEthernetSetMTU (unsigned nMTU);
+
+// returns the receive buffer size (at most USPI_FRAME_BUFFER_SIZE) needed for
+// frames up to nMTU, including the device's RX header
+int USPiEthernetRxBufferSize (unsigned nMTU);
+
+// nFlags of USPiEthernetSetRxFilter()
+#define USPI_RX_PROMISC		0x01	// receive all frames
+#define USPI_RX_ALLMULTI	0x02	// receive all multicast frames
+
+// frames to our own and the broadcast address always pass, multicast frames
+// to the nCount addresses in pMulticast (6 bytes each) are filtered by the
+// device; returns 0 on failure
+int USPiEthernetSetRxFilter (unsigned nFlags, const unsigned char *pMulticast, unsigned nCount);
+
+// returns != 0 if USPI_FRAME_TX_CSUM can be used and received frames are
+// checked by the device (LAN7800 only)
+int USPiEthernetChecksumOffload (void);
+
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+// pFrame as returned by a receive function, before the next receive
+// returns != 0 if the device has verified its IP and TCP/UDP checksums
+int USPiFrameChecksumValid (const void *pFrame);
+#endif
+
+// returns != 0 if USPI_FRAME_TX_TSO can be used (LAN7800 only)
+int USPiEthernetSegmentationOffload (void);
+
+// nFlags of the functions below, 0 if !USPiEthernetChecksumOffload()
+#define USPI_FRAME_TX_CSUM	0x01	// the device inserts the IP and TCP/UDP checksums
+// the device splits a TCP/IPv4 frame of up to USPI_FRAME_TX_TSO_MAX_SIZE bytes
+// into segments of USPI_FRAME_TX_MSS(mss) and inserts their checksums; not
+// with USPiQueueFrame(), 0 if !USPiEthernetSegmentationOffload()
+#define USPI_FRAME_TX_TSO	0x02
+#define USPI_FRAME_TX_MSS(mss)	(((mss) & 0x3FFF) << 16)
+#define USPI_FRAME_TX_TSO_MAX_SIZE	0x10000
+
+// sends without copying, the USPI_FRAME_TX_HEADROOM bytes in front of pFrame
+// are overwritten with the device's TX header and must be 4 byte aligned
+#define USPI_FRAME_TX_HEADROOM	8
+int USPiSendFrameInPlace (void *pFrame, unsigned nLength, unsigned nFlags);
+
+// returns the length of the longest frame the functions above send with nFlags
+int USPiEthernetTxMaxLength (unsigned nFlags);
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+// called from interrupt context when the transfer of a frame has finished,
+// bOK is 0 if it failed
+typedef void TUSPiFrameSentHandler (int bOK, void *pParam);
+
+// like USPiSendFrameInPlace, but returns once the transfer is posted, pFrame
+// must stay valid until pHandler is called; at most
+// CONFIG_RASPI_NET_TX_ASYNC_URBS can be pending, returns 0 on failure
+int USPiSendFrameAsync (void *pFrame, unsigned nLength, unsigned nFlags,
+			TUSPiFrameSentHandler *pHandler, void *pParam);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+// copies the frame into the TX batch, which goes out in one bulk-OUT transfer
+// when full or on USPiFlushFrames(), returns 0 on failure (of a flush too)
+int USPiQueueFrame (const void *pBuffer, unsigned nLength, unsigned nFlags);
+int USPiFlushFrames (void);
+#endif
+
 // pBuffer must have size USPI_FRAME_BUFFER_SIZE
 // returns 0 if no frame is available or on failure
+#ifdef CONFIG_RASPI_NET_JUMBO
+#define USPI_FRAME_BUFFER_SIZE	9216
+#else
 #define USPI_FRAME_BUFFER_SIZE	1600
+#endif
 int USPiReceiveFrame (void *pBuffer, unsigned *pResultLength);
 
+// like USPiReceiveFrame, but the device's RX header is left in front of the
+// frame, which starts at pBuffer + *pFrameOffset (saves moving the frame);
+// pBuffer has size nBufSize (see USPiEthernetRxBufferSize())
+int USPiReceiveFrameInPlace (void *pBuffer, unsigned nBufSize, unsigned *pResultLength,
+			     unsigned *pFrameOffset);
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+// returns the next frame of a multi-frame bulk-IN transfer, *ppFrame points
+// into the driver's buffer and is valid until the next call
+int USPiReceiveFrameAggregated (const void **ppFrame, unsigned *pResultLength);
+#endif
+
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+// prints the USB cycle counts once enough bulk transfers have been timed,
+// call it from thread context (it prints)
+void USPiCycleTraceDump (void);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+// called from interrupt context when a frame has been received into pBuffer,
+// it starts at pBuffer + nFrameOffset; nLength is 0 if the transfer failed
+typedef void TUSPiFrameReceivedHandler (void *pBuffer, unsigned nLength, unsigned nFrameOffset, void *pParam);
+
+// posts a receive into pBuffer (size nBufSize, 64 byte aligned) and returns
+// at once, at most CONFIG_RASPI_NET_RX_INTR_URBS can be pending
+// returns 0 on failure
+int USPiReceiveFrameAsync (void *pBuffer, unsigned nBufSize,
+			   TUSPiFrameReceivedHandler *pHandler, void *pParam);
+#endif
+
 //
 // GamePad device
 //
@@ -0,0 +1,50 @@
+//
+// dmapool.h
+//
+// Pool of DMA buffers, which are shared with the DWHCI controller
+//
+// USPi - An USB driver for Raspberry Pi written in C
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _uspi_dmapool_h
+#define _uspi_dmapool_h
+
+#include <uspi/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Buffers are carved from the Normal Non-Cacheable window (DMA_NC_BASE) and
+// are aligned to a cache line. The DWHCI driver does not need to clean or
+// invalidate the data cache for them.
+#define DMA_POOL_ALIGN		64
+
+// Allocates a buffer of at least nSize bytes from the smallest fitting slab.
+// Falls back to a cache-line aligned heap buffer if the request is too large
+// or the slab is exhausted.
+void *DMAPoolAllocate (unsigned nSize);
+
+// Releases a buffer returned by DMAPoolAllocate() (pool or heap buffer)
+void DMAPoolFree (void *pBuffer);
+
+// Returns TRUE if nAddress lies inside the non-cacheable pool area
+boolean DMAPoolContains (uintptr nAddress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
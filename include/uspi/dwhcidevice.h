@@ -20,6 +20,7 @@
 #ifndef _uspi_dwhcidevice_h
 #define _uspi_dwhcidevice_h
 
+#include <uk/config.h>
 #include <uspi/usb.h>
 #include <uspi/usbendpoint.h>
 #include <uspi/usbrequest.h>
@@ -30,11 +31,47 @@
 #include <uspi/usb.h>
 #include <uspi/types.h>
 #include <uspios.h>
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+#include <uk/semaphore.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// blocking transfers of different threads run at once up to this number,
+// the remaining channels are left to asynchronous requests
+#define DWHCI_BLOCKING_TRANSFERS	3
+
+// channels only control transfers may take, so that link checks and device
+// setup work while the network driver has its bulk requests posted
+#define DWHCI_CONTROL_CHANNELS		1
+
+// endpoints with requests posted asynchronously (the network adapter's
+// bulk-IN and bulk-OUT), each holds one channel however many are queued
+#define DWHCI_ASYNC_ENDPOINTS		2
+
+// host channels of the BCM2835 family's core
+#define DWHCI_CHANNELS			8
+
+// a blocking transfer must always find a channel, it does not wait for one
+#if DWHCI_BLOCKING_TRANSFERS + DWHCI_ASYNC_ENDPOINTS + DWHCI_CONTROL_CHANNELS > DWHCI_CHANNELS
+	#error DWHCI_BLOCKING_TRANSFERS is too large for the channels left
+#endif
+
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+// bulk-IN and bulk-OUT of the network adapter
+#define DWHCI_MAX_BOUND_CHANNELS	2
+
+typedef struct TDWHCIBoundChannel
+{
+	TUSBEndpoint *pEndpoint;
+	unsigned nChannel;
+	u32 nCharacter;				// channel parameters without ENABLE
+}
+TDWHCIBoundChannel;
+#endif
+
 typedef struct TDWHCIDevice
 {
 	unsigned m_nChannels;
@@ -42,7 +79,16 @@ typedef struct TDWHCIDevice
 
 	TDWHCITransferStageData m_StageData[DWHCI_MAX_CHANNELS];
 
-	volatile boolean m_bWaiting;
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	struct uk_semaphore m_TransferSlots;		// blocking transfers in flight
+#endif
+
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+	TDWHCIBoundChannel m_BoundChannel[DWHCI_MAX_BOUND_CHANNELS];
+	unsigned m_nBoundChannels;
+	unsigned m_nBoundChannelMask;			// one bit per channel, set if bound
+	volatile unsigned m_nBoundChannelBusy;		// one bit per channel, set if bound and in use
+#endif
 
 	TDWHCIRootPort m_RootPort;
 }
@@ -74,6 +120,18 @@ int DWHCIDeviceTransfer (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint, void *pBu
 boolean DWHCIDeviceSubmitBlockingRequest (TDWHCIDevice *pThis, TUSBRequest *pURB);
 boolean DWHCIDeviceSubmitAsyncRequest (TDWHCIDevice *pThis, TUSBRequest *pURB);
 
+#ifdef CONFIG_RASPI_USB_BOUND_CHANNELS
+// reserve a channel for a high-speed bulk endpoint, its parameters are set up
+// once here, so each transfer only writes size, DMA address and enable
+boolean DWHCIDeviceBindChannel (TDWHCIDevice *pThis, TUSBEndpoint *pEndpoint);
+#endif
+
+#ifdef CONFIG_RASPI_USB_CYCLE_TRACE
+// prints the cycle counts once CONFIG_RASPI_USB_CYCLE_TRACE_SAMPLES bulk
+// transfers have been timed, must be called from thread context
+void DWHCIDeviceCycleTraceDump (void);
+#endif
+
 TUSBSpeed DWHCIDeviceGetPortSpeed (TDWHCIDevice *pThis);
 boolean DWHCIDeviceOvercurrentDetected (TDWHCIDevice *pThis);
 void DWHCIDeviceDisableRootPort (TDWHCIDevice *pThis);
@@ -55,6 +55,28 @@ void DWHCIRegisterSetBit (TDWHCIRegister *pThis, unsigned nBit);
 void DWHCIRegisterClearAll (TDWHCIRegister *pThis);
 void DWHCIRegisterSetAll (TDWHCIRegister *pThis);
 
+// Direct accessors for the transfer and interrupt paths, which need no
+// register object. The core is mapped as Device-nGnRnE memory: accesses to
+// it are not gathered, not reordered and not acknowledged early, so they
+// reach the core in program order and a write has arrived before the next
+// access is issued. They are not ordered against normal memory, so
+// DataMemBarrier () is still required between filling a DMA buffer and
+// enabling a channel, and between reading a channel's status and using the
+// data it has received.
+typedef volatile u32 TDWHCIReg;
+
+#define DWHCI_REG(nAddress)	((TDWHCIReg *) (uintptr) (nAddress))
+
+static inline u32 DWHCIRead (const TDWHCIReg *pRegister)
+{
+	return *pRegister;
+}
+
+static inline void DWHCIWrite (TDWHCIReg *pRegister, u32 nValue)
+{
+	*pRegister = nValue;
+}
+
 #ifndef NDEBUG
 
 void DWHCIRegisterDump (TDWHCIRegister *pThis);
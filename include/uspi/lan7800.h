@@ -20,13 +20,44 @@
 #ifndef _uspi_lan7800_h
 #define _uspi_lan7800_h
 
+#include <uk/config.h>
 #include <uspi/usbfunction.h>
 #include <uspi/usbendpoint.h>
 #include <uspi/usbrequest.h>
 #include <uspi/macaddress.h>
+#include <uspi/netframe.h>
 #include <uspi/types.h>
 
-#define FRAME_BUFFER_SIZE	1600
+#ifdef CONFIG_RASPI_NET_JUMBO
+// RX header and a frame of LAN7800_MAX_MTU with VLAN tag and FCS
+#define LAN7800_FRAME_BUFFER_SIZE	9216
+#define LAN7800_MAX_MTU			9000
+#else
+#define LAN7800_FRAME_BUFFER_SIZE	1600
+#define LAN7800_MAX_MTU			1500
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+// bulk-OUT transfer size when several frames are sent together
+#define TX_BATCH_SIZE		CONFIG_RASPI_NET_TX_BATCH_SIZE
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+// bulk-IN requests which can be posted at the same time
+#define RX_ASYNC_REQUESTS	CONFIG_RASPI_NET_RX_INTR_URBS
+
+// called from interrupt context, nLength is 0 if the transfer failed
+typedef void TLAN7800FrameHandler (void *pBuffer, unsigned nLength, unsigned nFrameOffset, void *pParam);
+
+typedef struct TLAN7800RxRequest
+{
+	TUSBRequest m_URB;
+	TLAN7800FrameHandler *m_pHandler;
+	void *m_pParam;
+	boolean m_bInUse;
+}
+TLAN7800RxRequest;
+#endif
 
 typedef struct TLAN7800Device
 {
@@ -38,6 +69,23 @@ typedef struct TLAN7800Device
 	TMACAddress m_MACAddress;
 
 	u8 *m_pTxBuffer;
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	u8 *m_pTxBatch;			// TX_BATCH_SIZE, cacheable
+	unsigned m_nTxBatchLength;	// bytes queued in m_pTxBatch
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	TNetRxBatch m_RxBatch;
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	TLAN7800RxRequest m_RxRequest[RX_ASYNC_REQUESTS];
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	TNetTxQueue m_TxQueue;
+#endif
 }
 TLAN7800Device;
 
@@ -50,10 +98,82 @@ TMACAddress *LAN7800DeviceGetMACAddress (TLAN7800Device *pThis);
 
 boolean LAN7800DeviceSendFrame (TLAN7800Device *pThis, const void *pBuffer, unsigned nLength);
 
-// pBuffer must have size FRAME_BUFFER_SIZE
+// nFlags of the functions below which send without copying or queue
+#define LAN7800_TX_CSUM		0x01	// insert the IP and TCP/UDP checksums
+#define LAN7800_TX_LSO		0x02	// segment a TCP/IPv4 frame (not for queueing)
+#define LAN7800_TX_MSS(mss)	((mss) << 16)	// segment size with LAN7800_TX_LSO
+
+// maximum nLength of a frame sent with LAN7800_TX_LSO
+#define LAN7800_TX_LSO_MAX_SIZE	0x10000
+
+// Writes the TX command words into the NET_FRAME_TX_HEADROOM bytes in front of
+// pFrame (must be 4 byte aligned) and sends from there without copying
+boolean LAN7800DeviceSendFrameInPlace (TLAN7800Device *pThis, void *pFrame, unsigned nLength,
+				       unsigned nFlags);
+
+// pBuffer must have size LAN7800_FRAME_BUFFER_SIZE
 boolean LAN7800DeviceReceiveFrame (TLAN7800Device *pThis, void *pBuffer, unsigned *pResultLength);
 
+// Receives into pBuffer (size nBufSize, at most LAN7800_FRAME_BUFFER_SIZE) without
+// moving the frame down over the RX status header, the frame starts at pBuffer + *pFrameOffset
+boolean LAN7800DeviceReceiveFrameInPlace (TLAN7800Device *pThis, void *pBuffer, unsigned nBufSize,
+				     unsigned *pResultLength, unsigned *pFrameOffset);
+
+#ifdef CONFIG_RASPI_NET_CSUM_OFFLOAD
+// Returns TRUE if the device has verified the IP and TCP/UDP checksums of
+// pFrame, which must still be preceded by its RX header
+boolean LAN7800DeviceFrameChecksumValid (TLAN7800Device *pThis, const void *pFrame);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+// Like LAN7800DeviceSendFrameInPlace, but returns once the transfer is posted.
+// pFrame must stay valid until pHandler has been called.
+boolean LAN7800DeviceSendFrameAsync (TLAN7800Device *pThis, void *pFrame, unsigned nLength,
+				   unsigned nFlags, TNetFrameSentHandler *pHandler, void *pParam);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+// Appends the frame with its own TX command words to the batch buffer, which is
+// sent (flushed) once it could not take another frame of maximum size
+boolean LAN7800DeviceQueueFrame (TLAN7800Device *pThis, const void *pBuffer, unsigned nLength,
+				 unsigned nFlags);
+
+// Sends all queued frames in one bulk-OUT transfer
+boolean LAN7800DeviceFlushFrames (TLAN7800Device *pThis);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+// Returns the next frame of the current multi-frame bulk-IN transfer, issuing a
+// new transfer once all of its frames have been returned. *ppFrame points into
+// the driver's buffer and stays valid until the next call.
+boolean LAN7800DeviceReceiveFrameAggregated (TLAN7800Device *pThis, const void **ppFrame,
+					  unsigned *pResultLength);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+// Posts a bulk-IN request into pBuffer (size nBufSize, cache line aligned) and
+// returns at once. pHandler is called with the frame, which starts
+// at pBuffer + nFrameOffset. Empty and bad frames are received again into the
+// same buffer without calling pHandler.
+boolean LAN7800DeviceReceiveFrameAsync (TLAN7800Device *pThis, void *pBuffer, unsigned nBufSize,
+				      TLAN7800FrameHandler *pHandler, void *pParam);
+#endif
+
 // returns TRUE if PHY link is up
 boolean LAN7800DeviceIsLinkUp (TLAN7800Device *pThis);
 
+// Programs the receive filter. Frames to our own and the broadcast address
+// always pass, multicast frames if bAllMulticast is set or their destination
+// is one of the nCount addresses in pMulticast (MAC_ADDRESS_SIZE bytes each),
+// which are matched perfectly (the first 32) or through a hash.
+boolean LAN7800DeviceSetRxFilter (TLAN7800Device *pThis, boolean bPromisc, boolean bAllMulticast,
+				  const u8 *pMulticast, unsigned nCount);
+
+// Sets the maximum size of received frames, nMTU up to LAN7800_MAX_MTU
+boolean LAN7800DeviceSetMTU (TLAN7800Device *pThis, unsigned nMTU);
+
+// Returns the receive buffer size for frames up to nMTU with RX header, VLAN tag
+// and FCS, rounded up to full bulk packets
+unsigned LAN7800DeviceGetRxBufferSize (TLAN7800Device *pThis, unsigned nMTU);
+
 #endif
@@ -45,6 +45,8 @@ const u8 *MACAddressGet (TMACAddress *pThis);
 void MACAddressCopyTo (TMACAddress *pThis, u8 *pBuffer);
 
 boolean MACAddressIsBroadcast (TMACAddress *pThis);
+// Ethernet CRC-32 (MSB first, not complemented) for the hardware hash filters
+u32 MACAddressGetCRC (TMACAddress *pThis);
 unsigned MACAddressGetSize (TMACAddress *pThis);
 
 void MACAddressFormat (TMACAddress *pThis, TString *pString);
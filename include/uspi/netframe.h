@@ -0,0 +1,113 @@
+//
+// netframe.h
+//
+// USPi - An USB driver for Raspberry Pi written in C
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _uspi_netframe_h
+#define _uspi_netframe_h
+
+#include <uk/config.h>
+#include <uspi/dwhcidevice.h>
+#include <uspi/usbendpoint.h>
+#include <uspi/usbrequest.h>
+#include <uspi/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frame handling shared by the SMSC951x and LAN7800 drivers
+
+// Both devices take two TX command words in front of each frame. Frames sent
+// in place have them written into the NET_FRAME_TX_HEADROOM bytes in front
+// of the frame, which must be 4 byte aligned.
+#define NET_FRAME_TX_HEADROOM	8
+
+// returns TRUE if a frame of nLength bytes fits into a transfer buffer of
+// nBufSize bytes behind its TX command words
+static inline boolean NetFrameTxFits (unsigned nLength, unsigned nBufSize)
+{
+	return nLength + NET_FRAME_TX_HEADROOM <= nBufSize ? TRUE : FALSE;
+}
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+// bulk-IN transfer size when the device packs several frames per transfer
+#define RX_AGGREGATE_SIZE	CONFIG_RASPI_NET_RX_AGGREGATE_SIZE
+
+// Decodes the first word of the device's RX header into the frame length
+// (with FCS), returns FALSE if the device flagged the frame as bad
+typedef boolean TNetRxBatchStatusRoutine (u32 nRxStatus, unsigned *pFrameLength);
+
+// Splits multi-frame bulk-IN transfers, in which each frame follows its RX
+// header and the next header starts on a 4 byte boundary
+typedef struct TNetRxBatch
+{
+	u8 *m_pBuffer;			// RX_AGGREGATE_SIZE, cacheable
+	unsigned m_nLength;		// bytes received by the last transfer
+	unsigned m_nOffset;		// next RX header in m_pBuffer
+	unsigned m_nHeaderSize;
+	TNetRxBatchStatusRoutine *m_pStatusRoutine;
+}
+TNetRxBatch;
+
+void NetRxBatch (TNetRxBatch *pThis, unsigned nHeaderSize, TNetRxBatchStatusRoutine *pStatusRoutine);
+void _NetRxBatch (TNetRxBatch *pThis);
+
+// Returns the next good frame (without FCS) of the current transfer, issuing
+// a new transfer on pEndpoint once all of its frames have been returned.
+// *ppFrame points into m_pBuffer and stays valid until the next call.
+boolean NetRxBatchGetFrame (TNetRxBatch *pThis, TDWHCIDevice *pHost, TUSBEndpoint *pEndpoint,
+			    const void **ppFrame, unsigned *pResultLength);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+// bulk-OUT requests which can be posted at the same time
+#define TX_ASYNC_REQUESTS	CONFIG_RASPI_NET_TX_ASYNC_URBS
+
+// called from interrupt context, bOK is FALSE if the transfer failed
+typedef void TNetFrameSentHandler (boolean bOK, void *pParam);
+
+typedef struct TNetTxRequest
+{
+	TUSBRequest m_URB;
+	TNetFrameSentHandler *m_pHandler;
+	void *m_pParam;
+	boolean m_bInUse;
+}
+TNetTxRequest;
+
+// Posts bulk-OUT transfers without waiting for them, the host controller
+// driver sends them on the endpoint one after the other
+typedef struct TNetTxQueue
+{
+	TNetTxRequest m_Request[TX_ASYNC_REQUESTS];
+}
+TNetTxQueue;
+
+void NetTxQueue (TNetTxQueue *pThis);
+
+// Sends nLength bytes from pBuffer (the frame behind its TX command words)
+// on pEndpoint. Returns FALSE if all requests are pending or the transfer
+// cannot be posted, otherwise pHandler is called once it has completed.
+boolean NetTxQueueSend (TNetTxQueue *pThis, TDWHCIDevice *pHost, TUSBEndpoint *pEndpoint,
+			void *pBuffer, unsigned nLength, TNetFrameSentHandler *pHandler, void *pParam);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,13 +20,38 @@
 #ifndef _uspi_smsc951x_h
 #define _uspi_smsc951x_h
 
+#include <uk/config.h>
 #include <uspi/usbfunction.h>
 #include <uspi/usbendpoint.h>
 #include <uspi/usbrequest.h>
 #include <uspi/macaddress.h>
+#include <uspi/netframe.h>
 #include <uspi/types.h>
 
 #define FRAME_BUFFER_SIZE	1600
+#define SMSC951X_MAX_MTU	1500
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+// bulk-OUT transfer size when several frames are sent together
+#define TX_BATCH_SIZE		CONFIG_RASPI_NET_TX_BATCH_SIZE
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+// bulk-IN requests which can be posted at the same time
+#define RX_ASYNC_REQUESTS	CONFIG_RASPI_NET_RX_INTR_URBS
+
+// called from interrupt context, nLength is 0 if the transfer failed
+typedef void TSMSC951xFrameHandler (void *pBuffer, unsigned nLength, unsigned nFrameOffset, void *pParam);
+
+typedef struct TSMSC951xRxRequest
+{
+	TUSBRequest m_URB;
+	TSMSC951xFrameHandler *m_pHandler;
+	void *m_pParam;
+	boolean m_bInUse;
+}
+TSMSC951xRxRequest;
+#endif
 
 typedef struct TSMSC951xDevice
 {
@@ -38,6 +63,23 @@ typedef struct TSMSC951xDevice
 	TMACAddress m_MACAddress;
 
 	u8 *m_pTxBuffer;
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+	u8 *m_pTxBatch;			// TX_BATCH_SIZE, cacheable
+	unsigned m_nTxBatchLength;	// bytes queued in m_pTxBatch
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+	TNetRxBatch m_RxBatch;
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+	TSMSC951xRxRequest m_RxRequest[RX_ASYNC_REQUESTS];
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+	TNetTxQueue m_TxQueue;
+#endif
 }
 TSMSC951xDevice;
 
@@ -50,12 +92,61 @@ TMACAddress *SMSC951xDeviceGetMACAddress (TSMSC951xDevice *pThis);
 
 boolean SMSC951xDeviceSendFrame (TSMSC951xDevice *pThis, const void *pBuffer, unsigned nLength);
 
+// Writes the TX command words into the NET_FRAME_TX_HEADROOM bytes in front of
+// pFrame (must be 4 byte aligned) and sends from there without copying
+boolean SMSC951xDeviceSendFrameInPlace (TSMSC951xDevice *pThis, void *pFrame, unsigned nLength);
+
 // pBuffer must have size FRAME_BUFFER_SIZE
 boolean SMSC951xDeviceReceiveFrame (TSMSC951xDevice *pThis, void *pBuffer, unsigned *pResultLength);
 
+// Receives into pBuffer (size nBufSize, at most FRAME_BUFFER_SIZE) without moving
+// the frame down over the RX status header, the frame starts at pBuffer + *pFrameOffset
+boolean SMSC951xDeviceReceiveFrameInPlace (TSMSC951xDevice *pThis, void *pBuffer, unsigned nBufSize,
+				     unsigned *pResultLength, unsigned *pFrameOffset);
+
+#ifdef CONFIG_RASPI_NET_TX_ASYNC
+// Like SMSC951xDeviceSendFrameInPlace, but returns once the transfer is posted.
+// pFrame must stay valid until pHandler has been called.
+boolean SMSC951xDeviceSendFrameAsync (TSMSC951xDevice *pThis, void *pFrame, unsigned nLength,
+				   TNetFrameSentHandler *pHandler, void *pParam);
+#endif
+
+#ifdef CONFIG_RASPI_NET_TX_BATCH
+// Appends the frame with its own TX command words to the batch buffer, which is
+// sent (flushed) once it could not take another frame of maximum size
+boolean SMSC951xDeviceQueueFrame (TSMSC951xDevice *pThis, const void *pBuffer, unsigned nLength);
+
+// Sends all queued frames in one bulk-OUT transfer
+boolean SMSC951xDeviceFlushFrames (TSMSC951xDevice *pThis);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_AGGREGATE
+// Returns the next frame of the current multi-frame bulk-IN transfer, issuing a
+// new transfer once all of its frames have been returned. *ppFrame points into
+// the driver's buffer and stays valid until the next call.
+boolean SMSC951xDeviceReceiveFrameAggregated (TSMSC951xDevice *pThis, const void **ppFrame,
+					  unsigned *pResultLength);
+#endif
+
+#ifdef CONFIG_RASPI_NET_RX_INTR
+// Posts a bulk-IN request into pBuffer (size nBufSize, cache line aligned) and
+// returns at once. pHandler is called with the frame, which starts
+// at pBuffer + nFrameOffset. Empty and bad frames are received again into the
+// same buffer without calling pHandler.
+boolean SMSC951xDeviceReceiveFrameAsync (TSMSC951xDevice *pThis, void *pBuffer, unsigned nBufSize,
+				      TSMSC951xFrameHandler *pHandler, void *pParam);
+#endif
+
 // returns TRUE if PHY link is up
 boolean SMSC951xDeviceIsLinkUp (TSMSC951xDevice *pThis);
 
+// Programs the receive filter. Frames to our own and the broadcast address
+// always pass, multicast frames if bAllMulticast is set or their destination
+// hashes like one of the nCount addresses in pMulticast (MAC_ADDRESS_SIZE
+// bytes each).
+boolean SMSC951xDeviceSetRxFilter (TSMSC951xDevice *pThis, boolean bPromisc, boolean bAllMulticast,
+				   const u8 *pMulticast, unsigned nCount);
+
 // private:
 boolean SMSC951xDevicePHYWrite (TSMSC951xDevice *pThis, u8 uchIndex, u16 usValue);
 boolean SMSC951xDevicePHYRead (TSMSC951xDevice *pThis, u8 uchIndex, u16 *pValue);
@@ -20,6 +20,7 @@
 #ifndef _uspi_usb_h
 #define _uspi_usb_h
 
+#include <uk/config.h>
 #include <uspi/macros.h>
 
 // PID
@@ -38,6 +39,22 @@ TUSBPID;
 #define USB_FIRST_DEDICATED_ADDRESS	1
 #define USB_MAX_ADDRESS			127
 
+// Timing (ms)
+#define USB_TATTDB			100	// attach debounce
+#define USB_TDRSTR			50	// root port reset
+#ifdef CONFIG_RASPI_USB_FASTBOOT
+	// USB 2.0 spec minimums
+	#define USB_TRSTRCY		10	// reset recovery
+	#define USB_TDSETADDR		2	// SetAddress() recovery
+	#define USB_TSETCONFIG		2
+	#define USB_THUBRESET_POLL	10	// hub port reset status poll interval
+#else
+	// normally 10ms, seems to be too short for some devices
+	#define USB_TRSTRCY		20
+	#define USB_TDSETADDR		50
+	#define USB_TSETCONFIG		50
+#endif
+
 // Speed
 typedef enum
 {
@@ -37,6 +37,8 @@ typedef enum
 }
 TEndpointType;
 
+struct TUSBRequest;
+
 typedef struct TUSBEndpoint
 {
 	TUSBDevice	*m_pDevice;
@@ -46,6 +48,14 @@ typedef struct TUSBEndpoint
 	u32		 m_nMaxPacketSize;
 	unsigned	 m_nInterval;			// Milliseconds
 	TUSBPID		 m_NextPID;
+
+	// Requests on a bulk or interrupt endpoint are started one after the
+	// other, because each takes its data toggle from m_NextPID when it starts
+	// and advances it only when it completes (like the Linux dwc2 driver,
+	// which keeps one transfer per queue head).
+	boolean		 m_bActive;			// a request has been started
+	struct TUSBRequest *m_pPendingHead;		// waiting to be started
+	struct TUSBRequest *m_pPendingTail;
 }
 TUSBEndpoint;
 
@@ -69,6 +79,13 @@ TUSBPID USBEndpointGetNextPID (TUSBEndpoint *pThis, boolean bStatusStage);
 void USBEndpointSkipPID (TUSBEndpoint *pThis, unsigned nPackets, boolean bStatusStage);
 void USBEndpointResetPID (TUSBEndpoint *pThis);
 
+// called by the host controller driver with interrupts disabled
+// returns TRUE if the endpoint was idle and pURB may be started, else it is queued
+boolean USBEndpointBeginRequest (TUSBEndpoint *pThis, struct TUSBRequest *pURB);
+// the started request has finished, returns the queued request to start next
+// or 0 if the endpoint is idle now
+struct TUSBRequest *USBEndpointEndRequest (TUSBEndpoint *pThis);
+
 #ifdef __cplusplus
 }
 #endif
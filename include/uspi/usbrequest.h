@@ -20,9 +20,13 @@
 #ifndef _uspi_usbrequest_h
 #define _uspi_usbrequest_h
 
+#include <uk/config.h>
 #include <uspi/usb.h>
 #include <uspi/usbendpoint.h>
 #include <uspi/types.h>
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+#include <uk/semaphore.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +50,14 @@ typedef struct TUSBRequest		// URB
 	TURBCompletionRoutine *m_pCompletionRoutine;
 	void *m_pCompletionParam;
 	void *m_pCompletionContext;
+
+	struct TUSBRequest *m_pNext;		// queued on m_pEndpoint by the host controller driver
+
+	volatile boolean m_bWaiting;		// a blocking transfer stage is in progress
+#ifdef CONFIG_RASPI_USB_SLEEP_WAIT
+	volatile boolean m_bSleeping;		// its caller sleeps on m_Completion
+	struct uk_semaphore m_Completion;	// signalled when the stage completes
+#endif
 }
 TUSBRequest;
 
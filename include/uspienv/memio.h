@@ -26,9 +26,16 @@
 extern "C" {
 #endif
 
-u32 read32 (u32 nAddress);
+// addresses are unsigned long to reach the peripherals on AArch64 too
+static inline u32 read32 (unsigned long nAddress)
+{
+	return *(volatile u32 *) nAddress;
+}
 
-void write32 (u32 nAddress, u32 nValue);
+static inline void write32 (unsigned long nAddress, u32 nValue)
+{
+	*(volatile u32 *) nAddress = nValue;
+}
 
 #ifdef __cplusplus
 }
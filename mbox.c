@@ -30,6 +30,16 @@
 /* mailbox message buffer */
 volatile unsigned int  __attribute__((aligned(16))) mbox[MBOX_BUFFER_LENGTH];
 
+/* Filled in before the MMU is enabled and .bss is cleared for the second
+ * time, so these have to live in .data. The defaults describe the split the
+ * platform used to assume.
+ */
+unsigned long __attribute__((section(".data"))) raspi_arm_mem_base = 0;
+unsigned long __attribute__((section(".data"))) raspi_arm_mem_size = ARM_MEM_DEFAULT_END;
+unsigned long __attribute__((section(".data"))) raspi_vc_mem_base = ARM_MEM_DEFAULT_END;
+unsigned long __attribute__((section(".data"))) raspi_vc_mem_size = DEVICE_BASE - ARM_MEM_DEFAULT_END;
+unsigned long __attribute__((section(".data"))) raspi_dma_nc_base = ARM_MEM_DEFAULT_END - DMA_NC_SIZE;
+
 extern void clean_and_invalidate_dcache_range(void *start, unsigned long length);
 extern void invalidate_dcache_range(void *start, unsigned long length);
 
@@ -53,7 +63,7 @@ int mbox_call(unsigned char ch)
     unsigned int r = (((unsigned int)((unsigned long)&mbox)&~0xF) | (ch&0xF));
 
     // Ensure data coherency by cleaning and invalidating the data cache for the address
-    clean_and_invalidate_dcache_range(&mbox, MBOX_BUFFER_LENGTH);
+    clean_and_invalidate_dcache_range(&mbox, sizeof(mbox));
 
     // Wait until we can write to the mailbox
     do { asm volatile("nop"); } while (*MBOX_STATUS & MBOX_FULL);
@@ -70,9 +80,63 @@ int mbox_call(unsigned char ch)
         if (r == *MBOX_READ) {
             // Is it a valid successful response?
 
-            invalidate_dcache_range(&mbox, MBOX_BUFFER_LENGTH);
+            invalidate_dcache_range(&mbox, sizeof(mbox));
             return mbox[1] == MBOX_RESPONSE;
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+void mbox_get_mem_split(void)
+{
+    unsigned long arm_end;
+
+    mbox[0] = 13*4;
+    mbox[1] = MBOX_REQUEST;
+
+    mbox[2] = MBOX_TAG_GETARMMEM;
+    mbox[3] = 8;                    // value buffer size
+    mbox[4] = 0;
+    mbox[5] = 0;                    // base address
+    mbox[6] = 0;                    // size in bytes
+
+    mbox[7] = MBOX_TAG_GETVCMEM;
+    mbox[8] = 8;
+    mbox[9] = 0;
+    mbox[10] = 0;
+    mbox[11] = 0;
+
+    mbox[12] = MBOX_TAG_LAST;
+
+    // Keep the defaults if the firmware does not answer
+    if (!mbox_call(MBOX_CH_PROP) || mbox[6] == 0)
+        return;
+
+    raspi_arm_mem_base = mbox[5];
+    raspi_arm_mem_size = mbox[6];
+    raspi_vc_mem_base = mbox[10];
+    raspi_vc_mem_size = mbox[11];
+
+    // The page tables map RAM in 2 MiB sections
+    arm_end = (raspi_arm_mem_base + raspi_arm_mem_size) & ~(unsigned long)(DMA_NC_SIZE - 1);
+    if (arm_end > DEVICE_BASE)
+        arm_end = DEVICE_BASE;
+
+    raspi_dma_nc_base = arm_end - DMA_NC_SIZE;
+}
+
+int mbox_set_power_state(unsigned int device, unsigned int state)
+{
+    mbox[0] = 8*4;
+    mbox[1] = MBOX_REQUEST;
+
+    mbox[2] = MBOX_TAG_SETPOWER;
+    mbox[3] = 8;
+    mbox[4] = 0;
+    mbox[5] = device;
+    mbox[6] = state;
+
+    mbox[7] = MBOX_TAG_LAST;
+
+    return mbox_call(MBOX_CH_PROP);
+}
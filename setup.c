@@ -46,12 +46,19 @@
 #include <uk/arch/types.h>
 #include <stdio.h>
 #include <raspi/setup.h>
+#include <raspi/sysregs.h>
+#include <raspi/mbox.h>
+#include <raspi/string.h>
+#include <raspi/boottrace.h>
 
 #define SECONDARY_STACK_SIZE 4096
 
 static uint64_t assembly_entry;
 static uint64_t hardware_init_done;
 
+/* Bit n is set if core n reached the secondary spin loop (start.S) */
+extern uint32_t RPi_CoresReadyMask;
+
 /* Reserve one stack per secondary core (maxcores-1) */
 static char secondary_stacks[
     (CONFIG_UKPLAT_LCPU_MAXCOUNT - 1) * SECONDARY_STACK_SIZE
@@ -74,6 +81,10 @@ static void __libraspiplat_mem_init(void)
 		UK_CRASH("Failed to get bootinfo\n");
 	}
 
+	uk_pr_info("ARM memory: 0x%lx-0x%lx, VideoCore memory: 0x%lx-0x%lx\n",
+		   raspi_arm_mem_base, raspi_arm_mem_base + raspi_arm_mem_size,
+		   raspi_vc_mem_base, raspi_vc_mem_base + raspi_vc_mem_size);
+
 	// stack
 	int rc = ukplat_memregion_list_insert(
 		&bi->mrds,
@@ -164,7 +175,7 @@ static void __libraspiplat_mem_init(void)
 		&(struct ukplat_memregion_desc){
 			.vbase = __END,
 			.pbase = __END,
-			.len   = (size_t) ((MMIO_BASE/2 - 1) - (size_t) __END) / __PAGE_SIZE * __PAGE_SIZE,
+			.len   = (size_t) (DMA_NC_BASE - (size_t) __END) / __PAGE_SIZE * __PAGE_SIZE,
 			.type  = UKPLAT_MEMRT_FREE,
 			.flags = UKPLAT_MEMRF_READ |
 					UKPLAT_MEMRF_WRITE |
@@ -172,18 +183,71 @@ static void __libraspiplat_mem_init(void)
 		});
 	if (unlikely(rc < 0))
 		uk_pr_err("Failed to add heap memory region descriptor.\n");
+
+	// non-cacheable DMA window at the top of the ARM memory (mapped as Normal-NC in start.S)
+	rc = ukplat_memregion_list_insert(
+		&bi->mrds,
+		&(struct ukplat_memregion_desc){
+			.vbase = DMA_NC_BASE,
+			.pbase = DMA_NC_BASE,
+			.len   = DMA_NC_SIZE,
+			.type  = UKPLAT_MEMRT_RESERVED,
+			.flags = UKPLAT_MEMRF_READ |
+					UKPLAT_MEMRF_WRITE,
+		});
+	if (unlikely(rc < 0))
+		uk_pr_err("Failed to add DMA memory region descriptor.\n");
+
+	// VideoCore memory (firmware split, mapped as Normal-NC in start.S)
+	if (DMA_NC_END < DEVICE_BASE) {
+		rc = ukplat_memregion_list_insert(
+			&bi->mrds,
+			&(struct ukplat_memregion_desc){
+				.vbase = DMA_NC_END,
+				.pbase = DMA_NC_END,
+				.len   = DEVICE_BASE - DMA_NC_END,
+				.type  = UKPLAT_MEMRT_RESERVED,
+				.flags = UKPLAT_MEMRF_READ |
+						UKPLAT_MEMRF_WRITE,
+			});
+		if (unlikely(rc < 0))
+			uk_pr_err("Failed to add VideoCore memory region descriptor.\n");
+	}
 }
 
 void _libraspiplat_entry(uint64_t low0, uint64_t hi0, uint64_t low1, uint64_t hi1)
 {
+	int bt;
+
+	raspi_boottrace_init();
+
+	bt = raspi_boottrace_begin("plat: console init");
     _libraspiplat_init_console();
+	raspi_boottrace_end(bt);
+
+#ifdef CONFIG_RASPI_USB_FASTBOOT
+	/* Let the USB host controller power up while the rest of the system
+	 * boots; DWHCIDeviceInitialize() waits for it when the driver starts.
+	 */
+	mbox_set_power_state(MBOX_POWER_DEVICE_USB, MBOX_POWER_ON);
+#endif
+
+	bt = raspi_boottrace_begin("plat: memory regions");
 	__libraspiplat_mem_init();
+	raspi_boottrace_end(bt);
+#ifdef CONFIG_RASPI_STRING_BENCH
+	raspi_string_bench();
+#endif
 
+	bt = raspi_boottrace_begin("plat: irq init");
 	ukplat_irq_init();
+	raspi_boottrace_end(bt);
 
 	/* register local‑INTC lines 29/30 as the SMP IPIs */
     // Tells the generic SMP layer which lines are IPIs
+	bt = raspi_boottrace_begin("plat: lcpu_mp_init");
     int rc = lcpu_mp_init(RPI_HWIRQ_MB_RUN, RPI_HWIRQ_MB_WAKE, NULL);
+	raspi_boottrace_end(bt);
 
 	if (rc) {
         uk_pr_err("SMP: lcpu_mp_init failed: %d\n", rc);
@@ -204,25 +268,33 @@ void _libraspiplat_entry(uint64_t low0, uint64_t hi0, uint64_t low1, uint64_t hi
 		return;
 	}
 
-	__lcpuidx lcpus[] = { 1, 2, 3 };
-	unsigned int num = sizeof(lcpus) / sizeof(*lcpus);
-
-	// Build matching stacks & entries arrays
-	void *stacks[num];
-	ukplat_lcpu_entry_t entries[num];
+	__lcpuidx lcpus[3];
+	void *stacks[3];
+	unsigned int num = 0;
 
-	for (unsigned i = 0; i < num; i++) {
-		stacks[i]  = &secondary_stacks[i * SECONDARY_STACK_SIZE
+	// Only start the cores that parked at boot, each on its own stack
+	for (__lcpuidx i = 1; i <= 3; i++) {
+		if (!(RPi_CoresReadyMask & (1 << i))) {
+			uk_pr_err("SMP: core %u did not come up at boot\n", i);
+			continue;
+		}
+		lcpus[num] = i;
+		stacks[num] = &secondary_stacks[(i - 1) * SECONDARY_STACK_SIZE
 										+ SECONDARY_STACK_SIZE];
+		num++;
 	}
 
-	rc = ukplat_lcpu_start(
-		/* lcpuidx */  lcpus,
-		/* num     */ &num,
-		/* sp[]    */  stacks,
-		/* entry[] */  NULL,
-		/* flags   */  0
-	);
+	if (num) {
+		bt = raspi_boottrace_begin("plat: start secondary cores");
+		rc = ukplat_lcpu_start(
+			/* lcpuidx */  lcpus,
+			/* num     */ &num,
+			/* sp[]    */  stacks,
+			/* entry[] */  NULL,
+			/* flags   */  0
+		);
+		raspi_boottrace_end(bt);
+	}
 #endif /* CONFIG_HAVE_SMP */
 
 	/*
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Boot time microbenchmark for the string primitives in mm.S
+ * (CONFIG_RASPI_STRING_BENCH)
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <uk/print.h>
+#include <uk/config.h>
+#include <raspi/string.h>
+
+#define BENCH_BUFFER_SIZE	(64 * 1024)
+#define BENCH_BYTES		(4 * 1024 * 1024)	/* per measurement */
+
+static uint8_t bench_src[BENCH_BUFFER_SIZE] __attribute__((aligned(64)));
+static uint8_t bench_dst[BENCH_BUFFER_SIZE + 64] __attribute__((aligned(64)));
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1514, 4096, 65536 };
+
+/* The loops mm.S and start.S used before */
+static void old_memzero(void *dst, unsigned long n)
+{
+	__asm__ __volatile__(
+		"1:	str	xzr, [%0], #8\n"
+		"	subs	%1, %1, #8\n"
+		"	b.gt	1b\n"
+		: "+r"(dst), "+r"(n) : : "memory", "cc");
+}
+
+static void old_bss_clear(void *dst, unsigned long n)
+{
+	uint8_t *end = (uint8_t *) dst + n;
+
+	__asm__ __volatile__(
+		"1:	str	wzr, [%0], #4\n"
+		"	cmp	%1, %0\n"
+		"	b.hi	1b\n"
+		: "+r"(dst) : "r"(end) : "memory", "cc");
+}
+
+static inline uint64_t bench_cycles(void)
+{
+	uint64_t c;
+
+	__asm__ __volatile__("isb; mrs %0, pmccntr_el0" : "=r"(c));
+	return c;
+}
+
+static void bench_pmu_enable(void)
+{
+	uint64_t v;
+
+	__asm__ __volatile__("mrs %0, pmcr_el0" : "=r"(v));
+	v |= (1 << 0) | (1 << 2);	/* E: enable, C: reset cycle counter */
+	__asm__ __volatile__("msr pmcr_el0, %0" : : "r"(v));
+	__asm__ __volatile__("msr pmcntenset_el0, %0" : : "r"(1UL << 31));
+	__asm__ __volatile__("isb");
+}
+
+#define BENCH(name, size, stmt)						\
+	do {								\
+		unsigned long _iters = BENCH_BYTES / (size);		\
+		uint64_t _t0 = bench_cycles();				\
+		for (unsigned long _i = 0; _i < _iters; _i++)		\
+			stmt;						\
+		uint64_t _t = bench_cycles() - _t0;			\
+		uk_pr_info("  %-14s %6lu B: %4lu.%02lu cycles/64B\n",	\
+			   name, (unsigned long) (size),		\
+			   (unsigned long) (_t * 64 / BENCH_BYTES),	\
+			   (unsigned long) (_t * 6400 / BENCH_BYTES % 100)); \
+	} while (0)
+
+void raspi_string_bench(void)
+{
+	bench_pmu_enable();
+
+	for (size_t i = 0; i < BENCH_BUFFER_SIZE; i++)
+		bench_src[i] = (uint8_t) i;
+
+	uk_pr_info("string primitives (%u MiB per measurement):\n",
+		   BENCH_BYTES >> 20);
+
+	for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+		size_t n = bench_sizes[i];
+
+		BENCH("old memzero", n, old_memzero(bench_dst, n));
+		BENCH("old bss clear", n, old_bss_clear(bench_dst, n));
+		BENCH("memzero", n, memzero(bench_dst, n));
+		BENCH("memset", n, memset(bench_dst, 0x5a, n));
+		BENCH("raspi_memset", n, raspi_memset(bench_dst, 0x5a, n));
+		BENCH("memcpy", n, memcpy(bench_dst + 1, bench_src, n));
+		BENCH("raspi_memcpy", n, raspi_memcpy(bench_dst + 1, bench_src, n));
+	}
+
+	/* Sanity check the unaligned copy and the tail handling */
+	raspi_memset(bench_dst, 0, sizeof(bench_dst));
+	raspi_memcpy(bench_dst + 3, bench_src + 1, 1000);
+	if (memcmp(bench_dst + 3, bench_src + 1, 1000) || bench_dst[2] || bench_dst[1003])
+		uk_pr_err("raspi_memcpy produced wrong data\n");
+}
@@ -161,6 +161,22 @@ uint64_t get_system_timer(void)
 	return ((uint64_t)h << 32) | l;
 }
 
+/**
+ * Busy-wait on the generic timer, scaled by cntfrq
+ */
+void raspi_udelay(uint32_t us)
+{
+	uint64_t freq = get_el0(cntfrq);
+	uint64_t ticks = (freq * us + 999999) / 1000000;
+	uint64_t start;
+
+	isb();
+	start = get_el0(cntvct);
+	do {
+		isb();
+	} while (get_el0(cntvct) - start < ticks);
+}
+
 uint32_t get_timer_irq_delay(void)
 {
 	return timer_irq_delay;